@@ -1,18 +1,24 @@
+#include <iostream>
 #include <stdexcept>
 #include "astro_camera.hpp"
+#include "frame_trace.hpp"
+
+// Full resolution stills that can be queued for writing at once
+#define STILL_POOL_SIZE 4
 
 using namespace libcamera;
 
-AstroCamera::AstroCamera(std::shared_ptr<Camera> camera, process_request_t processRequest, uint16_t width, uint16_t height)
-    : m_camera(camera), m_request_processor(processRequest), m_display_width(width), m_display_height(height)
+AstroCamera::AstroCamera(std::shared_ptr<Camera> camera, FrameHandler frameHandler, uint16_t width, uint16_t height, bool rawStills)
+    : m_camera(camera), m_frame_handler(std::move(frameHandler)), m_display_width(width), m_display_height(height), m_raw_stills(rawStills)
 {
     m_allocator = std::make_unique<FrameBufferAllocator>(m_camera);
-    m_camera->requestCompleted.connect(m_request_processor);
+    m_camera->requestCompleted.connect(this, &AstroCamera::requestComplete);
 }
 
 AstroCamera::~AstroCamera()
 {
     m_camera->stop();
+    m_buffer_cache.clear();
     for (auto iter = m_config->begin(); iter != m_config->end(); iter++)
         m_allocator->free(iter->stream());
     for (auto &request : m_still_requests)
@@ -29,17 +35,26 @@ AstroCamera::~AstroCamera()
 
 void AstroCamera::start()
 {
+    StreamRole stillRole = m_raw_stills ? StreamRole::Raw : StreamRole::StillCapture;
 #ifdef __ARM_ARCH
-    m_config = m_camera->generateConfiguration({StreamRole::StillCapture, StreamRole::Viewfinder});
+    m_config = m_camera->generateConfiguration({stillRole, StreamRole::Viewfinder});
 #else
-    m_config = m_camera->generateConfiguration({StreamRole::StillCapture});
+    m_config = m_camera->generateConfiguration({stillRole});
 #endif
     if (m_config == NULL)
     {
         throw std::runtime_error{"Unable to generate configuration"};
     }
     StreamConfiguration &stillConfig = m_config->at(0);
-    stillConfig.pixelFormat = libcamera::formats::RGB888;
+    if (m_raw_stills)
+    {
+        // validate() swaps in the sensor's own Bayer order, but keeps it unpacked 12 bit
+        stillConfig.pixelFormat = libcamera::formats::SRGGB12;
+    }
+    else
+    {
+        stillConfig.pixelFormat = libcamera::formats::RGB888;
+    }
 #ifdef __ARM_ARCH
     StreamConfiguration &viewFinderStreamConfig = m_config->at(1);
     std::cout << "Default ViewFinder configuration is: " << viewFinderStreamConfig.toString() << std::endl;
@@ -54,11 +69,13 @@ void AstroCamera::start()
         throw std::runtime_error("Failed to configure camera");
     }
 
+    std::cout << "Validated Still configuration is: " << stillConfig.toString() << std::endl;
 #ifdef __ARM_ARCH
     std::cout << "Validated ViewFinder configuration is: " << viewFinderStreamConfig.toString() << std::endl;
     m_viewfinder_requests = allocateStream(viewFinderStreamConfig, VIEWFINDER_COOKIE);
 #endif
     m_still_requests = allocateStream(stillConfig, STILL_CAPTURE_COOKIE);
+    m_still_pool = std::make_shared<FramePool>(STILL_POOL_SIZE, stillConfig.frameSize);
     m_camera->start();
 #ifdef __ARM_ARCH
     startPreview();
@@ -107,6 +124,11 @@ std::vector<std::unique_ptr<Request>> AstroCamera::allocateStream(StreamConfigur
             throw std::runtime_error("Can't set buffer for request");
         }
 
+        if (!m_buffer_cache.add(buffer.get(), Image::MapMode::ReadOnly, cfg))
+        {
+            throw std::runtime_error("Can't map buffer for request");
+        }
+
         requests.push_back(std::move(request));
     }
 
@@ -125,3 +147,56 @@ void AstroCamera::queueRequest(Request *request)
 {
     m_camera->queueRequest(request);
 }
+
+// Runs on libcamera's thread, each request carries a single buffer
+void AstroCamera::requestComplete(Request *request)
+{
+    if (request->status() == Request::RequestCancelled)
+    {
+        std::cout << "Request Cancelled" << std::endl;
+        return;
+    }
+
+    for (auto bufferPair : request->buffers())
+    {
+        const FrameBuffer *buffer = bufferPair.second;
+        const FrameMetadata &metadata = buffer->metadata();
+
+        CapturedFrame frame;
+        frame.cookie = request->cookie();
+        frame.image = mappedImage(buffer);
+        frame.info.sequence = metadata.sequence;
+        frame.info.timestamp_ns = metadata.timestamp;
+        const ControlList &requestMetadata = request->metadata();
+        if (auto exposure = requestMetadata.get(controls::ExposureTime))
+            frame.info.exposure_us = *exposure;
+        if (auto gain = requestMetadata.get(controls::AnalogueGain))
+            frame.info.analogue_gain = *gain;
+        frame.metadata = &requestMetadata;
+        frame.handle = request;
+        if (frame.cookie == VIEWFINDER_COOKIE)
+        {
+            trace_frame(TraceStage::Sensor, frame.info.sequence, frame.info.timestamp_ns);
+            trace_frame(TraceStage::RequestComplete, frame.info.sequence);
+        }
+        m_frame_handler(frame);
+    }
+}
+
+void AstroCamera::release(const CapturedFrame &frame)
+{
+    Request *request = static_cast<Request *>(frame.handle);
+    request->reuse(Request::ReuseBuffers);
+    if (frame.cookie == VIEWFINDER_COOKIE)
+        queueRequest(request);
+}
+
+Image *AstroCamera::mappedImage(const FrameBuffer *buffer) const
+{
+    return m_buffer_cache.find(buffer);
+}
+
+std::shared_ptr<FramePool> AstroCamera::stillPool() const
+{
+    return m_still_pool;
+}
@@ -2,31 +2,41 @@
 
 #include <memory>
 #include <libcamera/libcamera.h>
+#include "frame_buffer_cache.hpp"
+#include "frame_pool.hpp"
+#include "frame_source.hpp"
 
-typedef void(*process_request_t)(libcamera::Request *);
-#define VIEWFINDER_COOKIE 0x0001
-#define STILL_CAPTURE_COOKIE 0x0010
-
-class AstroCamera {
+class AstroCamera : public FrameSource {
 
     std::shared_ptr<libcamera::Camera> m_camera;
     std::unique_ptr<libcamera::FrameBufferAllocator> m_allocator;
     std::unique_ptr<libcamera::CameraConfiguration> m_config;
     std::vector<std::unique_ptr<libcamera::Request>> m_viewfinder_requests;
     std::vector<std::unique_ptr<libcamera::Request>> m_still_requests;
-    process_request_t m_request_processor;
+    FrameBufferCache m_buffer_cache;
+    std::shared_ptr<FramePool> m_still_pool;
+    FrameHandler m_frame_handler;
     uint16_t m_display_width;
     uint16_t m_display_height;
+    bool m_raw_stills;
 
     public:
-        AstroCamera(std::shared_ptr<libcamera::Camera>, process_request_t processRequest, uint16_t width, uint16_t height);
-        void requestStillFrame();
-        void start();
+        /*
+         * With rawStills the still stream is the sensor's 12 bit Bayer output,
+         * written losslessly as DNG, rather than ISP processed RGB888.
+         */
+        AstroCamera(std::shared_ptr<libcamera::Camera>, FrameHandler frameHandler, uint16_t width, uint16_t height, bool rawStills = false);
+        void requestStillFrame() override;
+        void start() override;
         void startPreview();
+        void release(const CapturedFrame &frame) override;
         void queueRequest(libcamera::Request *request);
+        Image *mappedImage(const libcamera::FrameBuffer *buffer) const;
+        std::shared_ptr<FramePool> stillPool() const override;
         ~AstroCamera();
 
     private:
+        void requestComplete(libcamera::Request *request);
         std::vector<std::unique_ptr<libcamera::Request>> allocateStream(
             libcamera::StreamConfiguration &cfg, uint64_t cookie = 0);
 };
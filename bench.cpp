@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include <getopt.h>
+#include <unistd.h>
+#include "image.h"
+
+// Each benchmark runs at least this long, after one untimed warm-up call
+#define BENCH_MIN_TIME_S (0.5)
+#define BENCH_MAX_ITERATIONS (1000000)
+
+/*
+ * Every operator new in the process is counted, worker threads included,
+ * so allocations per call covers everything a kernel does.
+ */
+static std::atomic<uint64_t> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *pointer = malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void *pointer = aligned_alloc(align, (size + align - 1) / align * align))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept { free(pointer); }
+
+struct Resolution
+{
+    const char *name;
+    int width;
+    int height;
+};
+
+// the SSD1351 and ILI9341/TP28017 panels, and the HQ camera's full sensor
+static const Resolution resolutions[] = {
+    {"128x128", 128, 128},
+    {"320x240", 320, 240},
+    {"4056x3040", 4056, 3040},
+};
+
+struct Benchmark
+{
+    std::string name;
+    size_t pixels;
+    // empty when the input has no kernel for it, listed as unsupported rather than left out
+    std::function<void()> body;
+};
+
+struct Result
+{
+    uint64_t iterations = 0;
+    double seconds = 0;
+    uint64_t allocations = 0;
+};
+
+static Result run_benchmark(const Benchmark &benchmark, double minTime)
+{
+    using clock = std::chrono::steady_clock;
+    benchmark.body();
+
+    // grow the batch until it fills the minimum time, like Google Benchmark
+    Result result;
+    uint64_t batch = 1;
+    while (true)
+    {
+        uint64_t allocationsBefore = allocations.load(std::memory_order_relaxed);
+        auto start = clock::now();
+        for (uint64_t i = 0; i < batch; i++)
+            benchmark.body();
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+        result.iterations = batch;
+        result.seconds = seconds;
+        result.allocations = allocations.load(std::memory_order_relaxed) - allocationsBefore;
+        if (seconds >= minTime || batch >= BENCH_MAX_ITERATIONS)
+            return result;
+
+        double scale = seconds > 0 ? minTime * 1.4 / seconds : 10;
+        batch = std::min<uint64_t>(BENCH_MAX_ITERATIONS, std::max<uint64_t>(batch + 1, batch * std::min(scale, 10.0)));
+    }
+}
+
+// Noise rather than a flat colour, so the JPEG encoder has real work to do
+static std::vector<uint8_t> synthetic_frame(size_t length, uint32_t seed)
+{
+    std::vector<uint8_t> data(length);
+    uint32_t state = seed;
+    for (size_t i = 0; i < length; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        data[i] = (uint8_t)((i & 0xFF) ^ (state & 0x1F));
+    }
+    return data;
+}
+
+static std::shared_ptr<Image> synthetic_image(const Resolution &resolution, unsigned int bytesPerPixel,
+                                              PixelColourFormat format)
+{
+    unsigned int stride = resolution.width * bytesPerPixel;
+    return Image::fromBuffer(synthetic_frame((size_t)stride * resolution.height, resolution.width),
+                             resolution.width, resolution.height, stride, format);
+}
+
+static void add_conversions(std::vector<Benchmark> &benchmarks, const std::string &input,
+                            const Resolution &resolution, std::shared_ptr<Image> image)
+{
+    using VectorConversion = std::vector<uint8_t> (Image::*)();
+    using SpanConversion = size_t (Image::*)(libcamera::Span<uint8_t>);
+    static const struct
+    {
+        const char *name;
+        VectorConversion toVector;
+        SpanConversion intoSpan;
+    } conversions[] = {
+        {"dataAsRGB565", &Image::dataAsRGB565, &Image::dataAsRGB565},
+        {"dataAsRGB888", &Image::dataAsRGB888, &Image::dataAsRGB888},
+        {"dataAsBGR888", &Image::dataAsBGR888, &Image::dataAsBGR888},
+        {"dataAsXXR888", &Image::dataAsXXR888, &Image::dataAsXXR888},
+        // what the viewfinder uses with the panel in RGB565 mode
+        {"dataAsBGR565", &Image::dataAsBGR565, &Image::dataAsBGR565},
+        {"dataAsXXR565", &Image::dataAsXXR565, &Image::dataAsXXR565},
+    };
+
+    const size_t pixels = (size_t)resolution.width * resolution.height;
+    const std::string suffix = "/" + input + "/" + resolution.name;
+    auto output = std::make_shared<std::vector<uint8_t>>(pixels * 3);
+    for (const auto &conversion : conversions)
+    {
+        auto toVector = conversion.toVector;
+        auto intoSpan = conversion.intoSpan;
+        // not every conversion takes every input, e.g. RGB565 has no YUYV kernel
+        if (!(image.get()->*intoSpan)(libcamera::Span<uint8_t>(output->data(), output->size())))
+        {
+            benchmarks.push_back({std::string(conversion.name) + suffix, pixels, nullptr});
+            benchmarks.push_back({std::string(conversion.name) + "(span)" + suffix, pixels, nullptr});
+            continue;
+        }
+        benchmarks.push_back({std::string(conversion.name) + suffix, pixels, [image, toVector] {
+            (image.get()->*toVector)();
+        }});
+        benchmarks.push_back({std::string(conversion.name) + "(span)" + suffix, pixels, [image, intoSpan, output] {
+            (image.get()->*intoSpan)(libcamera::Span<uint8_t>(output->data(), output->size()));
+        }});
+    }
+}
+
+static std::vector<Benchmark> build_benchmarks(const std::string &directory)
+{
+    std::vector<Benchmark> benchmarks;
+    for (const Resolution &resolution : resolutions)
+    {
+        const size_t pixels = (size_t)resolution.width * resolution.height;
+
+        // what the viewfinder stream delivers
+        add_conversions(benchmarks, "XRGB8888", resolution, synthetic_image(resolution, 4, PixelColourFormat::XRGB8888));
+        add_conversions(benchmarks, "YUYV", resolution, synthetic_image(resolution, 2, PixelColourFormat::YUYV));
+        add_conversions(benchmarks, "RGB888", resolution, synthetic_image(resolution, 3, PixelColourFormat::RGB888));
+
+        // what the still stream delivers, RGB888 or 12 bit Bayer
+        auto rgb = synthetic_image(resolution, 3, PixelColourFormat::RGB888);
+        std::string jpeg = directory + "/bench_" + resolution.name + ".jpg";
+        benchmarks.push_back({std::string("writeToFile/RGB888/") + resolution.name, pixels, [rgb, jpeg] {
+            rgb->writeToFile(jpeg);
+        }});
+        auto bayer = synthetic_image(resolution, 2, PixelColourFormat::SRGGB12);
+        std::string dng = directory + "/bench_" + resolution.name + ".dng";
+        benchmarks.push_back({std::string("writeToFile/SRGGB12/") + resolution.name, pixels, [bayer, dng] {
+            bayer->writeToFile(dng);
+        }});
+    }
+    return benchmarks;
+}
+
+static void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [--filter SUBSTRING] [--min-time SECONDS] [--dir DIRECTORY]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option longOptions[] = {
+        {"filter", required_argument, nullptr, 'f'},
+        {"min-time", required_argument, nullptr, 't'},
+        {"dir", required_argument, nullptr, 'd'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    std::string filter;
+    double minTime = BENCH_MIN_TIME_S;
+    std::string directory;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:t:d:h", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                minTime = strtod(optarg, nullptr);
+                break;
+            case 'd':
+                directory = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    // encoded stills go somewhere scratch unless asked to keep them
+    bool removeDirectory = false;
+    if (directory.empty())
+    {
+        char scratch[] = "/tmp/astro-pi-bench-XXXXXX";
+        if (!mkdtemp(scratch))
+        {
+            std::cerr << "Failed to create a scratch directory" << std::endl;
+            return EXIT_FAILURE;
+        }
+        directory = scratch;
+        removeDirectory = true;
+    }
+
+    std::cout << std::left << std::setw(40) << "Benchmark" << std::right
+              << std::setw(16) << "Time" << std::setw(12) << "Iterations"
+              << std::setw(12) << "MPix/s" << std::setw(14) << "Allocs/call" << std::endl
+              << std::string(94, '-') << std::endl;
+
+    for (const Benchmark &benchmark : build_benchmarks(directory))
+    {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+            continue;
+        if (!benchmark.body)
+        {
+            std::cout << std::left << std::setw(40) << benchmark.name << std::right
+                      << std::setw(16) << "unsupported" << std::endl;
+            continue;
+        }
+
+        Result result = run_benchmark(benchmark, minTime);
+        double nanoseconds = result.seconds * 1e9 / result.iterations;
+        double megapixels = benchmark.pixels * result.iterations / result.seconds / 1e6;
+        double perCall = (double)result.allocations / result.iterations;
+        std::cout << std::left << std::setw(40) << benchmark.name << std::right << std::fixed
+                  << std::setw(13) << std::setprecision(0) << nanoseconds << " ns"
+                  << std::setw(12) << result.iterations
+                  << std::setw(12) << std::setprecision(1) << megapixels
+                  << std::setw(14) << std::setprecision(1) << perCall << std::endl;
+    }
+
+    if (removeDirectory)
+    {
+        for (const Resolution &resolution : resolutions)
+        {
+            unlink((directory + "/bench_" + resolution.name + ".jpg").c_str());
+            unlink((directory + "/bench_" + resolution.name + ".dng").c_str());
+        }
+        rmdir(directory.c_str());
+    }
+
+    return EXIT_SUCCESS;
+}
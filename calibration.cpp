@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "calibration.hpp"
+#include "dng_writer.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+
+#define MASTERS_MAGIC 0x4c414350 // "PCAL"
+#define MASTERS_VERSION 1
+#define MASTERS_HAVE_DARK (1 << 0)
+#define MASTERS_HAVE_FLAT (1 << 1)
+#define MASTERS_ALIGNMENT 64
+
+// gain is fixed point with 12 fractional bits, so at most just under 8x
+#define GAIN_SHIFT 12
+#define GAIN_ONE (1 << GAIN_SHIFT)
+#define GAIN_MAX INT16_MAX
+
+struct MastersHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t row_samples;
+    uint32_t sample_size;
+    uint32_t flags;
+};
+
+static size_t align_up(size_t size)
+{
+    return (size + MASTERS_ALIGNMENT - 1) & ~(size_t)(MASTERS_ALIGNMENT - 1);
+}
+
+static size_t masters_size(size_t samples)
+{
+    return align_up(sizeof(MastersHeader)) + 3 * align_up(samples * sizeof(uint16_t));
+}
+
+static inline int32_t calibrate_sample(int32_t light, int32_t dark, int32_t gain, int32_t offset, int32_t max)
+{
+    int32_t value = ((light - dark) * gain + (1 << (GAIN_SHIFT - 1))) >> GAIN_SHIFT;
+    value = std::clamp(value, (int32_t)INT16_MIN, (int32_t)INT16_MAX) + offset;
+    return std::clamp(value, 0, max);
+}
+
+static void calibrate_row_u8_scalar(uint8_t *row, const uint16_t *dark, const uint16_t *gain, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        row[i] = calibrate_sample(row[i], dark[i], gain[i], 0, UINT8_MAX);
+}
+
+static void calibrate_row_u16_scalar(uint16_t *row, const uint16_t *dark, const uint16_t *gain, size_t count,
+                                     int16_t offset, int16_t max)
+{
+    for (size_t i = 0; i < count; i++)
+        row[i] = calibrate_sample(row[i], dark[i], gain[i], offset, max);
+}
+
+/*
+ * The vector kernels work on 16 bit lanes: light - dark fits because the
+ * samples are at most 12 bits, and the gain is at most INT16_MAX.
+ */
+#if HAVE_NEON
+
+static inline int16x8_t neon_calibrate(int16x8_t light, const uint16_t *dark, const uint16_t *gain)
+{
+    int16x8_t diff = vsubq_s16(light, vreinterpretq_s16_u16(vld1q_u16(dark)));
+    int16x8_t g = vreinterpretq_s16_u16(vld1q_u16(gain));
+    int32x4_t lo = vmull_s16(vget_low_s16(diff), vget_low_s16(g));
+    int32x4_t hi = vmull_s16(vget_high_s16(diff), vget_high_s16(g));
+    return vcombine_s16(vqrshrn_n_s32(lo, GAIN_SHIFT), vqrshrn_n_s32(hi, GAIN_SHIFT));
+}
+
+static void calibrate_row_u8(uint8_t *row, const uint16_t *dark, const uint16_t *gain, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t in = vld1q_u8(row + i);
+        int16x8_t lo = neon_calibrate(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(in))), dark + i, gain + i);
+        int16x8_t hi = neon_calibrate(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(in))), dark + i + 8, gain + i + 8);
+        vst1q_u8(row + i, vcombine_u8(vqmovun_s16(lo), vqmovun_s16(hi)));
+    }
+    calibrate_row_u8_scalar(row + i, dark + i, gain + i, count - i);
+}
+
+static void calibrate_row_u16(uint16_t *row, const uint16_t *dark, const uint16_t *gain, size_t count,
+                              int16_t offset, int16_t max)
+{
+    const int16x8_t offsets = vdupq_n_s16(offset);
+    const int16x8_t zero = vdupq_n_s16(0);
+    const int16x8_t maxes = vdupq_n_s16(max);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        int16x8_t value = neon_calibrate(vreinterpretq_s16_u16(vld1q_u16(row + i)), dark + i, gain + i);
+        value = vminq_s16(vmaxq_s16(vqaddq_s16(value, offsets), zero), maxes);
+        vst1q_u16(row + i, vreinterpretq_u16_s16(value));
+    }
+    calibrate_row_u16_scalar(row + i, dark + i, gain + i, count - i, offset, max);
+}
+
+#elif HAVE_SSE2
+
+static inline __m128i sse2_calibrate(__m128i light, const uint16_t *dark, const uint16_t *gain)
+{
+    const __m128i round = _mm_set1_epi32(1 << (GAIN_SHIFT - 1));
+    __m128i diff = _mm_sub_epi16(light, _mm_loadu_si128((const __m128i *)dark));
+    __m128i g = _mm_loadu_si128((const __m128i *)gain);
+    __m128i lo = _mm_mullo_epi16(diff, g);
+    __m128i hi = _mm_mulhi_epi16(diff, g);
+    __m128i p0 = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(lo, hi), round), GAIN_SHIFT);
+    __m128i p1 = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(lo, hi), round), GAIN_SHIFT);
+    return _mm_packs_epi32(p0, p1);
+}
+
+static void calibrate_row_u8(uint8_t *row, const uint16_t *dark, const uint16_t *gain, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(row + i));
+        __m128i lo = sse2_calibrate(_mm_unpacklo_epi8(in, zero), dark + i, gain + i);
+        __m128i hi = sse2_calibrate(_mm_unpackhi_epi8(in, zero), dark + i + 8, gain + i + 8);
+        _mm_storeu_si128((__m128i *)(row + i), _mm_packus_epi16(lo, hi));
+    }
+    calibrate_row_u8_scalar(row + i, dark + i, gain + i, count - i);
+}
+
+static void calibrate_row_u16(uint16_t *row, const uint16_t *dark, const uint16_t *gain, size_t count,
+                              int16_t offset, int16_t max)
+{
+    const __m128i offsets = _mm_set1_epi16(offset);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i maxes = _mm_set1_epi16(max);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i value = sse2_calibrate(_mm_loadu_si128((const __m128i *)(row + i)), dark + i, gain + i);
+        value = _mm_min_epi16(_mm_max_epi16(_mm_adds_epi16(value, offsets), zero), maxes);
+        _mm_storeu_si128((__m128i *)(row + i), value);
+    }
+    calibrate_row_u16_scalar(row + i, dark + i, gain + i, count - i, offset, max);
+}
+
+#else
+
+static void calibrate_row_u8(uint8_t *row, const uint16_t *dark, const uint16_t *gain, size_t count)
+{
+    calibrate_row_u8_scalar(row, dark, gain, count);
+}
+
+static void calibrate_row_u16(uint16_t *row, const uint16_t *dark, const uint16_t *gain, size_t count,
+                              int16_t offset, int16_t max)
+{
+    calibrate_row_u16_scalar(row, dark, gain, count, offset, max);
+}
+
+#endif
+
+Calibration::~Calibration()
+{
+    close();
+}
+
+void Calibration::close()
+{
+    if (m_map)
+        munmap(m_map, m_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_map = nullptr;
+    m_size = 0;
+    m_header = nullptr;
+    m_dark = m_flat = m_gain = nullptr;
+}
+
+size_t Calibration::sampleCount() const
+{
+    return (size_t)m_header->row_samples * m_header->height;
+}
+
+bool Calibration::open(const std::string &filename)
+{
+    close();
+
+    m_fd = ::open(filename.c_str(), O_RDWR);
+    if (m_fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(m_fd, &st) < 0 || (size_t)st.st_size < sizeof(MastersHeader))
+    {
+        std::cerr << filename << " is not a calibration masters file" << std::endl;
+        close();
+        return false;
+    }
+
+    m_size = st.st_size;
+    void *address = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (address == MAP_FAILED)
+    {
+        std::cerr << "Failed to mmap " << filename << ": " << strerror(errno) << std::endl;
+        close();
+        return false;
+    }
+    m_map = address;
+    m_header = static_cast<MastersHeader *>(m_map);
+
+    if (m_header->magic != MASTERS_MAGIC || m_header->version != MASTERS_VERSION ||
+        m_size != masters_size(sampleCount()))
+    {
+        std::cerr << filename << " is not a calibration masters file" << std::endl;
+        close();
+        return false;
+    }
+
+    uint8_t *planes = static_cast<uint8_t *>(m_map) + align_up(sizeof(MastersHeader));
+    size_t planeSize = align_up(sampleCount() * sizeof(uint16_t));
+    m_dark = reinterpret_cast<uint16_t *>(planes);
+    m_flat = reinterpret_cast<uint16_t *>(planes + planeSize);
+    m_gain = reinterpret_cast<uint16_t *>(planes + 2 * planeSize);
+    return true;
+}
+
+bool Calibration::create(const std::string &filename, const Image &image)
+{
+    close();
+
+    const size_t rowSamples = image.isBayer() ? image.width() : image.width() * 3;
+    const size_t samples = rowSamples * image.height();
+
+    int fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to create " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    // reserve the blocks now so writing the masters later can't fail for space
+    int ret = posix_fallocate(fd, 0, masters_size(samples));
+    if (ret)
+    {
+        std::cerr << "Failed to allocate " << filename << ": " << strerror(ret) << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    MastersHeader header = {};
+    header.magic = MASTERS_MAGIC;
+    header.version = MASTERS_VERSION;
+    header.width = image.width();
+    header.height = image.height();
+    header.format = image.format();
+    header.row_samples = rowSamples;
+    header.sample_size = image.isBayer() ? 2 : 1;
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+    {
+        std::cerr << "Failed to write " << filename << ": " << strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    ::close(fd);
+
+    if (!open(filename))
+        return false;
+
+    // until there are masters, subtract the sensor pedestal and apply unity gain
+    std::fill_n(m_dark, samples, image.isBayer() ? DNG_BLACK_LEVEL : 0);
+    std::fill_n(m_gain, samples, GAIN_ONE);
+    return true;
+}
+
+bool Calibration::matches(const Image &image) const
+{
+    return m_header && m_header->width == (uint32_t)image.width() &&
+           m_header->height == (uint32_t)image.height() && m_header->format == (uint32_t)image.format();
+}
+
+bool Calibration::hasDark() const
+{
+    return m_header && (m_header->flags & MASTERS_HAVE_DARK);
+}
+
+bool Calibration::hasFlat() const
+{
+    return m_header && (m_header->flags & MASTERS_HAVE_FLAT);
+}
+
+bool Calibration::apply(Image &image) const
+{
+    if (!matches(image))
+    {
+        std::cerr << "Calibration masters don't match a " << image.width() << "x" << image.height()
+                  << " still, leaving it uncalibrated" << std::endl;
+        return false;
+    }
+    if (!(m_header->flags & (MASTERS_HAVE_DARK | MASTERS_HAVE_FLAT)))
+        return true;
+
+    libcamera::Span<uint8_t> plane = image.data(0);
+    const unsigned int stride = image.stride();
+    const size_t rowSamples = m_header->row_samples;
+    const bool bayer = m_header->sample_size == 2;
+
+    parallel_for(m_header->height, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++)
+        {
+            uint8_t *row = plane.data() + y * stride;
+            const uint16_t *dark = m_dark + y * rowSamples;
+            const uint16_t *gain = m_gain + y * rowSamples;
+            if (bayer)
+                calibrate_row_u16((uint16_t *)row, dark, gain, rowSamples, DNG_BLACK_LEVEL, DNG_WHITE_LEVEL);
+            else
+                calibrate_row_u8(row, dark, gain, rowSamples);
+        }
+    });
+    return true;
+}
+
+static void copy_samples(const Image &image, uint16_t *dst, size_t rowSamples)
+{
+    libcamera::Span<const uint8_t> plane = image.data(0);
+    for (int y = 0; y < image.height(); y++)
+    {
+        const uint8_t *row = plane.data() + (size_t)y * image.stride();
+        uint16_t *out = dst + y * rowSamples;
+        if (image.isBayer())
+            memcpy(out, row, rowSamples * sizeof(uint16_t));
+        else
+            std::copy(row, row + rowSamples, out);
+    }
+}
+
+bool Calibration::storeDark(const Image &dark)
+{
+    if (!matches(dark))
+        return false;
+    copy_samples(dark, m_dark, m_header->row_samples);
+    m_header->flags |= MASTERS_HAVE_DARK;
+    updateGain();
+    msync(m_map, m_size, MS_SYNC);
+    return true;
+}
+
+bool Calibration::storeFlat(const Image &flat)
+{
+    if (!matches(flat))
+        return false;
+    copy_samples(flat, m_flat, m_header->row_samples);
+    m_header->flags |= MASTERS_HAVE_FLAT;
+    updateGain();
+    msync(m_map, m_size, MS_SYNC);
+    return true;
+}
+
+void Calibration::updateGain()
+{
+    const size_t samples = sampleCount();
+    if (!hasFlat())
+    {
+        std::fill_n(m_gain, samples, GAIN_ONE);
+        return;
+    }
+
+    // normalise each colour channel separately so the flat doesn't shift the white balance
+    const size_t rowSamples = m_header->row_samples;
+    const bool bayer = m_header->sample_size == 2;
+    auto channel = [&](size_t index) {
+        size_t x = index % rowSamples;
+        return bayer ? ((index / rowSamples) & 1) * 2 + (x & 1) : x % 3;
+    };
+
+    double sums[4] = {};
+    size_t counts[4] = {};
+    for (size_t i = 0; i < samples; i++)
+    {
+        sums[channel(i)] += std::max((int)m_flat[i] - (int)m_dark[i], 0);
+        counts[channel(i)]++;
+    }
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        size_t c = channel(i);
+        double mean = counts[c] ? sums[c] / counts[c] : 0;
+        int signal = std::max((int)m_flat[i] - (int)m_dark[i], 1);
+        m_gain[i] = std::min<long>(std::lround(mean * GAIN_ONE / signal), GAIN_MAX);
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include "image.h"
+
+/*
+ * Master dark and flat frames for still calibration, kept in a file that
+ * is sized up front and mapped, so loading the masters at startup is
+ * just an mmap. The file holds the dark, the flat and a per-sample gain
+ * derived from them, all as 16 bit samples laid out like the stills
+ * (one sample per Bayer site, or three per RGB pixel).
+ *
+ * apply() computes (light - dark) * gain in one pass per row, where gain
+ * is mean(flat - dark) / (flat - dark) per colour channel in Q12 fixed
+ * point. Bayer stills keep the sensor black level as a pedestal so the
+ * DNG black level stays correct.
+ */
+class Calibration {
+    int m_fd = -1;
+    void *m_map = nullptr;
+    size_t m_size = 0;
+    struct MastersHeader *m_header = nullptr;
+    uint16_t *m_dark = nullptr;
+    uint16_t *m_flat = nullptr;
+    uint16_t *m_gain = nullptr;
+
+    public:
+        Calibration() = default;
+        Calibration(const Calibration &) = delete;
+        Calibration &operator=(const Calibration &) = delete;
+        ~Calibration();
+
+        // Maps an existing masters file, false if there isn't a valid one
+        bool open(const std::string &filename);
+        // Preallocates and maps a fresh masters file for stills like `image`
+        bool create(const std::string &filename, const Image &image);
+        void close();
+
+        bool matches(const Image &image) const;
+        bool hasDark() const;
+        bool hasFlat() const;
+
+        bool apply(Image &image) const;
+        bool storeDark(const Image &dark);
+        bool storeFlat(const Image &flat);
+
+    private:
+        size_t sampleCount() const;
+        void updateGain();
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Callables up to this size are stored inside InlineFunction itself, enough for a captured CapturedFrame
+#define INLINE_FUNCTION_SIZE 64
+
+/*
+ * A move-only void() callable. Small callables, such as a function
+ * pointer plus a couple of bound arguments, live in the object itself,
+ * so queueing one doesn't allocate. Bigger ones go on the heap, like
+ * std::function.
+ */
+class InlineFunction {
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_FUNCTION_SIZE];
+    void (*m_invoke)(void *storage) = nullptr;
+    // move constructs into to and destroys from, or just destroys when to is null
+    void (*m_manage)(void *from, void *to) = nullptr;
+
+    template<typename F>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(F) <= INLINE_FUNCTION_SIZE && alignof(F) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<F>;
+    }
+
+    public:
+        InlineFunction() = default;
+
+        template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, InlineFunction>>>
+        InlineFunction(F &&function)
+        {
+            using Callable = std::decay_t<F>;
+            if constexpr (fitsInline<Callable>())
+            {
+                new (m_storage) Callable(std::forward<F>(function));
+                m_invoke = [](void *storage) { (*static_cast<Callable *>(storage))(); };
+                m_manage = [](void *from, void *to) {
+                    Callable *callable = static_cast<Callable *>(from);
+                    if (to)
+                        new (to) Callable(std::move(*callable));
+                    callable->~Callable();
+                };
+            }
+            else
+            {
+                new (m_storage) Callable *(new Callable(std::forward<F>(function)));
+                m_invoke = [](void *storage) { (**static_cast<Callable **>(storage))(); };
+                m_manage = [](void *from, void *to) {
+                    Callable *callable = *static_cast<Callable **>(from);
+                    if (to)
+                        new (to) Callable *(callable);
+                    else
+                        delete callable;
+                };
+            }
+        }
+
+        InlineFunction(InlineFunction &&other) noexcept
+        {
+            *this = std::move(other);
+        }
+
+        InlineFunction &operator=(InlineFunction &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                if (other.m_manage)
+                {
+                    other.m_manage(other.m_storage, m_storage);
+                    m_invoke = other.m_invoke;
+                    m_manage = other.m_manage;
+                    other.m_invoke = nullptr;
+                    other.m_manage = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        InlineFunction(const InlineFunction &) = delete;
+        InlineFunction &operator=(const InlineFunction &) = delete;
+
+        ~InlineFunction()
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            if (m_manage)
+                m_manage(m_storage, nullptr);
+            m_invoke = nullptr;
+            m_manage = nullptr;
+        }
+
+        explicit operator bool() const
+        {
+            return m_invoke != nullptr;
+        }
+
+        void operator()()
+        {
+            m_invoke(m_storage);
+        }
+};
+
+/*
+ * Bounded lock-free queue for many producers and a single consumer,
+ * after Dmitry Vyukov's bounded MPMC queue. Each cell carries a sequence
+ * number saying whether it's free for the producer at that position or
+ * holds a value for the consumer, so producers only contend on a single
+ * compare-exchange of the tail and the consumer needs no atomics of its
+ * own. Capacity must be a power of two.
+ */
+template<typename T, size_t Capacity>
+class MpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    Cell m_cells[Capacity];
+    alignas(64) std::atomic<size_t> m_tail{0};
+    // only touched by the consumer
+    alignas(64) size_t m_head = 0;
+
+    public:
+        MpscRing()
+        {
+            for (size_t i = 0; i < Capacity; i++)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        // False, leaving value alone, when the ring is full
+        bool tryPush(T &value)
+        {
+            size_t position = m_tail.load(std::memory_order_relaxed);
+            Cell *cell;
+            while (true)
+            {
+                cell = &m_cells[position & (Capacity - 1)];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+                if (difference == 0)
+                {
+                    if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (difference < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    position = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side only, true when tryPop would find nothing published
+        bool empty() const
+        {
+            const Cell &cell = m_cells[m_head & (Capacity - 1)];
+            return (intptr_t)cell.sequence.load(std::memory_order_acquire) - (intptr_t)(m_head + 1) < 0;
+        }
+
+        // Consumer side only
+        bool tryPop(T &value)
+        {
+            Cell &cell = m_cells[m_head & (Capacity - 1)];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if ((intptr_t)sequence - (intptr_t)(m_head + 1) < 0)
+                return false;
+            value = std::move(cell.value);
+            cell.sequence.store(m_head + Capacity, std::memory_order_release);
+            m_head++;
+            return true;
+        }
+};
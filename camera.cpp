@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -7,6 +8,7 @@
 #include <cstring>
 #include <cstdio>
 #include <fcntl.h>
+#include <getopt.h>
 
 #ifndef __ARM_ARCH
 #include <signal.h>
@@ -20,6 +22,28 @@
 #define USE_ILI9341_DISPLAY (0)
 #endif
 #define SHOW_IMAGE_METADATA (0)
+#define DISPLAY_DELTA_UPDATES (0)
+#define DISPLAY_RGB565 (1)
+// used when the stream being previewed isn't the panel's size
+#define VIEWFINDER_FILTER (ResampleFilter::Bilinear)
+// show each still on the panel as it's captured, box filtered down to size
+#define PREVIEW_STILLS (0)
+#define STILL_PREVIEW_FILTER (ResampleFilter::Box)
+#define RAW_STILLS (0)
+// seconds between stats lines on stdout, 0 for none
+#define STATS_INTERVAL (10)
+
+#define IMAGE_WRITER_THREADS (3)
+#define IMAGE_WRITER_QUEUE_LENGTH (4)
+#define IMAGE_WRITER_QUEUE_POLICY (QueuePolicy::DropOldest)
+#define IMAGE_WRITER_FORMAT (OutputFormat::Native)
+#define STACK_STILLS (0)
+#define STACK_MODE (StackMode::Mean)
+#define STACK_SNAPSHOT_INTERVAL (10)
+#define CALIBRATION_MODE (CalibrationMode::Off)
+#define CALIBRATION_FILE "calibration.masters"
+#define CORRECT_HOT_PIXELS (0)
+#define HOT_PIXEL_FILE "hotpixels.map"
 
 #define SHUTTER_BUTTON_GPIO_PIN (6)
 #define MODE_SWITCH_GPIO_PIN (5)
@@ -30,14 +54,21 @@
 #include "image.h"
 #include "button.hpp"
 #include "astro_camera.hpp"
+#include "replay_source.hpp"
 #include "image_writer.hpp"
+#include "display_worker.hpp"
+#include "frame_trace.hpp"
+#include "metrics.hpp"
 
 #if USE_SSD1351_DISPLAY
 #include "ssd1351.hpp"
+#include "spidev_bus.hpp"
 #elif USE_TP28017_DISPLAY
 #include "tp28017.hpp"
+#include "parallel_bus.hpp"
 #elif USE_ILI9341_DISPLAY
 #include "ili9341.hpp"
+#include "spidev_bus.hpp"
 #endif
 
 #if WRITE_IMAGES_TO_SERVER
@@ -47,111 +78,117 @@
 using namespace libcamera;
 using namespace std::chrono_literals;
 
-static std::unique_ptr<AstroCamera> astro_cam;
+static std::unique_ptr<FrameSource> frame_source;
 static EventLoop loop;
-static uint32_t frame_count;
+static uint32_t last_viewfinder_sequence;
+static bool viewfinder_started = false;
 static volatile bool night_mode = false;
 
-#if USE_SSD1351_DISPLAY || USE_ILI9341_DISPLAY
+#if USE_SSD1351_DISPLAY || USE_TP28017_DISPLAY || USE_ILI9341_DISPLAY
 static std::unique_ptr<Display> display;
+static std::unique_ptr<DisplayWorker> display_worker;
+static int display_width;
+static int display_height;
+
+// Converts into the display worker's back buffer, it draws on its own thread
+static void show_on_display(Image *image, ResampleFilter filter, uint32_t frame = TRACE_NO_FRAME)
+{
+    const uint8_t bytesPerPixel = display->bytesPerPixel();
+    // a frame of another size is resampled to the panel, so every path writes one panel's worth
+    const size_t panelLength = (size_t)display_width * display_height * bytesPerPixel;
+    auto output = display_worker->backBuffer(panelLength);
+    PanelFormat format;
+    if (bytesPerPixel == 2)
+        format = night_mode ? PanelFormat::XXR565 : PanelFormat::BGR565;
+    else
+        format = night_mode ? PanelFormat::XXR888 : PanelFormat::BGR888;
+    const size_t length = image->dataAsPanel(output, display_width, display_height, format, filter);
+    if (frame != TRACE_NO_FRAME)
+        trace_frame(TraceStage::ConvertEnd, frame);
+    if (length)
+        display_worker->present(length, frame);
+}
 #endif
-#if USE_TP28017_DISPLAY
-static std::unique_ptr<Tp28017> display;
-#endif
 
-static void processRequest(Request *request)
+// Counts a viewfinder frame, and any the camera skipped since the last one
+static void count_viewfinder_frame(uint32_t sequence)
+{
+    if (viewfinder_started && sequence - last_viewfinder_sequence > 1)
+        metrics().camera_frames_dropped.add(sequence - last_viewfinder_sequence - 1);
+    last_viewfinder_sequence = sequence;
+    viewfinder_started = true;
+    metrics().viewfinder_frames.add();
+}
+
+static void processFrame(const CapturedFrame &frame)
 {
+    if (frame.cookie == VIEWFINDER_COOKIE)
+        trace_frame(TraceStage::Dispatch, frame.info.sequence);
+
 #if SHOW_IMAGE_METADATA
     std::cout << std::endl
-              << "Request completed: " << request->toString() << std::endl;
+              << "Frame completed: seq: " << std::setw(6) << std::setfill('0') << frame.info.sequence
+              << " timestamp: " << frame.info.timestamp_ns << std::endl;
 
-    const ControlList &requestMetadata = request->metadata();
-    for (const auto &ctrl : requestMetadata)
+    if (frame.metadata)
     {
-        const ControlId *id = controls::controls.at(ctrl.first);
-        const ControlValue &value = ctrl.second;
+        for (const auto &ctrl : *frame.metadata)
+        {
+            const ControlId *id = controls::controls.at(ctrl.first);
+            const ControlValue &value = ctrl.second;
 
-        std::cout << "\t" << id->name() << " = " << value.toString()
-                  << std::endl;
+            std::cout << "\t" << id->name() << " = " << value.toString()
+                      << std::endl;
+        }
     }
 #endif
 
-    const Request::BufferMap &buffers = request->buffers();
-    for (auto bufferPair : buffers)
+    /*
+     * Image data can be accessed here, the source keeps it mapped until
+     * the frame is released
+     */
+    if (frame.cookie == VIEWFINDER_COOKIE)
     {
-        const Stream *const stream = bufferPair.first;
-        FrameBuffer *buffer = bufferPair.second;
-        const FrameMetadata &metadata = buffer->metadata();
-
-#if SHOW_IMAGE_METADATA
-        /* Print some information about the buffer which has completed. */
-        std::cout << " seq: " << std::setw(6) << std::setfill('0') << metadata.sequence
-                  << " timestamp: " << metadata.timestamp
-                  << " bytesused: ";
-
-        unsigned int nplane = 0;
-        for (const FrameMetadata::Plane &plane : metadata.planes())
-        {
-            std::cout << plane.bytesused;
-            if (++nplane < metadata.planes().size())
-                std::cout << "/";
-        }
-
-        std::cout << std::endl;
-#endif
-
-        /*
-         * Image data can be accessed here, but the FrameBuffer
-         * must be mapped by the application
-         */
-        auto &config = stream->configuration();
 #if USE_SSD1351_DISPLAY || USE_TP28017_DISPLAY || USE_ILI9341_DISPLAY
-        if (request->cookie() == VIEWFINDER_COOKIE)
-        {
-            std::unique_ptr<Image> image = Image::fromFrameBuffer(buffer, Image::MapMode::ReadOnly, config);
-            std::vector<uint8_t> imageData;
-            if (night_mode)
-            {
-                imageData = image->dataAsXXR888();
-            }
-            else
-            {
-                imageData = image->dataAsBGR888();
-            }
-            auto data = libcamera::Span(imageData.data(), imageData.size());
-            display->drawImage(data);
-            frame_count++;
-        }
+        show_on_display(frame.image, VIEWFINDER_FILTER, frame.info.sequence);
 #endif
-        if (request->cookie() == STILL_CAPTURE_COOKIE)
+        count_viewfinder_frame(frame.info.sequence);
+    }
+    if (frame.cookie == STILL_CAPTURE_COOKIE)
+    {
+        metrics().stills_captured.add();
+        // never wait for the writers here, that would stall the viewfinder behind them
+        std::unique_ptr<Image> image = Image::copyFromImage(*frame.image, frame_source->stillPool());
+        if (image)
         {
-            std::unique_ptr<Image> image = Image::copyFromFrameBuffer(buffer, config);
+            image->setCaptureInfo(frame.info);
+#if PREVIEW_STILLS && (USE_SSD1351_DISPLAY || USE_TP28017_DISPLAY || USE_ILI9341_DISPLAY)
+            show_on_display(image.get(), STILL_PREVIEW_FILTER);
+#endif
             enqueue_image(std::move(image));
         }
+        else
+        {
+            std::cerr << "Still buffers all in use, dropping frame " << frame.info.sequence << std::endl;
+            metrics().stills_dropped.add();
+        }
     }
 
-    /* Re-queue the Request to the camera. */
-    request->reuse(Request::ReuseBuffers);
-    if (request->cookie() == VIEWFINDER_COOKIE)
-    {
-        astro_cam->queueRequest(request);
-    }
+    /* Hand the buffer back, the camera re-queues its Request. */
+    frame_source->release(frame);
+    if (frame.cookie == VIEWFINDER_COOKIE)
+        trace_frame(TraceStage::Requeue, frame.info.sequence);
 }
 
-static void requestComplete(Request *request)
+// Called on the source's thread, the frame is processed on the event loop
+static void frameReady(const CapturedFrame &frame)
 {
-    if (request->status() == Request::RequestCancelled)
-    {
-        std::cout << "Request Cancelled" << std::endl;
-        return;
-    }
-
-    loop.callLater(std::bind(&processRequest, request));
+    loop.callLater([frame] { processFrame(frame); });
 }
 
 static void deferredStillRequest()
 {
-    astro_cam->requestStillFrame();
+    frame_source->requestStillFrame();
 }
 
 static void shutterButtonPress(int pin_signal)
@@ -164,29 +201,112 @@ static void modeButtonPress(int pin_signal)
     night_mode = !night_mode;
 }
 
-int main()
+static void usage(const char *program)
 {
-    std::unique_ptr<CameraManager> cm = std::make_unique<CameraManager>();
-    cm->start();
+    std::cerr << "Usage: " << program << " [--replay FILE --size WxH [--format yuyv|rgb888|xrgb8888|srggb12...]" << std::endl
+              << "        [--stride BYTES] [--fps RATE] [--still-interval FRAMES]]" << std::endl
+              << "        [--duration SECONDS] [--trace FILE] [--stats SECONDS]" << std::endl;
+}
 
-    auto cameras = cm->cameras();
-    if (cameras.empty())
+int main(int argc, char **argv)
+{
+    static const struct option longOptions[] = {
+        {"replay", required_argument, nullptr, 'r'},
+        {"size", required_argument, nullptr, 's'},
+        {"format", required_argument, nullptr, 'f'},
+        {"stride", required_argument, nullptr, 'S'},
+        {"fps", required_argument, nullptr, 'F'},
+        {"still-interval", required_argument, nullptr, 'i'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"trace", required_argument, nullptr, 't'},
+        {"stats", required_argument, nullptr, 'm'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    ReplayOptions replay;
+    unsigned int duration = 0;
+    std::string traceFile;
+    unsigned int statsInterval = STATS_INTERVAL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "r:s:f:S:F:i:d:t:m:h", longOptions, nullptr)) != -1)
     {
-        std::cout << "No cameras were identified on the system."
-                  << std::endl;
-        cm->stop();
-        return EXIT_FAILURE;
+        switch (opt)
+        {
+            case 'r':
+                replay.filename = optarg;
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &replay.width, &replay.height) != 2)
+                {
+                    std::cerr << "Bad frame size " << optarg << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+                if (!parse_replay_format(optarg, replay))
+                {
+                    std::cerr << "Unknown replay format " << optarg << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                replay.stride = strtoul(optarg, nullptr, 0);
+                break;
+            case 'F':
+                replay.fps = strtod(optarg, nullptr);
+                break;
+            case 'i':
+                replay.still_interval = strtoul(optarg, nullptr, 0);
+                break;
+            case 'd':
+                duration = strtoul(optarg, nullptr, 0);
+                break;
+            case 't':
+                traceFile = optarg;
+                break;
+            case 'm':
+                statsInterval = strtoul(optarg, nullptr, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
     }
 
-    std::string cameraId = cameras[0]->id();
+    std::unique_ptr<CameraManager> cm;
+    std::shared_ptr<Camera> camera;
+    if (replay.filename.empty())
+    {
+        cm = std::make_unique<CameraManager>();
+        cm->start();
+
+        auto cameras = cm->cameras();
+        if (cameras.empty())
+        {
+            std::cout << "No cameras were identified on the system."
+                      << std::endl;
+            cm->stop();
+            return EXIT_FAILURE;
+        }
+
+        std::string cameraId = cameras[0]->id();
 
-    std::shared_ptr<Camera> camera = cm->get(cameraId);
+        camera = cm->get(cameraId);
 
-    if (camera->acquire())
+        if (camera->acquire())
+        {
+            std::cout << "Failed to acquire camera" << std::endl;
+            cm->stop();
+            return EXIT_FAILURE;
+        }
+    }
+    else
     {
-        std::cout << "Failed to acquire camera" << std::endl;
-        cm->stop();
-        return EXIT_FAILURE;
+        auto replaySource = std::make_unique<ReplaySource>(replay, &frameReady);
+        if (!replaySource->open())
+            return EXIT_FAILURE;
+        frame_source = std::move(replaySource);
     }
 
 #ifdef __ARM_ARCH
@@ -203,39 +323,81 @@ int main()
 uint16_t width = 0;
 uint16_t height = 0;
 #if USE_SSD1351_DISPLAY
-    //                                                   cs, dc, rst
-    display = std::make_unique<Ssd1351>("/dev/spidev0.0", 8,  5,  6);
+    //                                                                                cs, dc, rst
+    display = std::make_unique<Ssd1351>(std::make_unique<SpidevBus>("/dev/spidev0.0", 8,  5,  6));
     width = 128;
     height = 128;
 #elif USE_ILI9341_DISPLAY
-    //                                                   cs, dc, rst
-    display = std::make_unique<ILI9341>("/dev/spidev0.0", 8, 25, 27);
+    //                                                                                cs, dc, rst, backlight
+    display = std::make_unique<ILI9341>(std::make_unique<SpidevBus>("/dev/spidev0.0", 8, 25, 27,  18));
     width = 320;
     height = 240;
 #elif USE_TP28017_DISPLAY
-    //                                  cs, rs, rd, wr, rst)
-    display = std::make_unique<Tp28017>(19, 16, 20, 26,   5);
+    //                                                    cs, rs, rd, wr, rst)
+    display = std::make_unique<Tp28017>(make_parallel_bus(19, 16, 20, 26,   5));
     width = 320;
     height = 240;
 #endif
 #if USE_SSD1351_DISPLAY || USE_TP28017_DISPLAY || USE_ILI9341_DISPLAY
     display->fillWithColour(0xff0000);
+    display->setRgb565(DISPLAY_RGB565);
+    display->setDeltaMode(DISPLAY_DELTA_UPDATES);
+    display_width = width;
+    display_height = height;
+#if USE_TP28017_DISPLAY
+    display_worker = std::make_unique<DisplayWorker>([](libcamera::Span<uint8_t> &data) {
+        display->drawImage(data);
+    });
+#else
+    // queue frames on the SPI I/O thread so converting the next one overlaps the transfer
+    display_worker = std::make_unique<DisplayWorker>(
+        [](libcamera::Span<uint8_t> &data) { return display->drawImageAsync(data); },
+        [](TransferToken token) { display->waitForTransfer(token); });
+#endif
 #endif
 
-    astro_cam = std::make_unique<AstroCamera>(camera, &requestComplete, width, height);
-    astro_cam->start();
-
-    start_image_processing();
-
+    if (camera)
+        frame_source = std::make_unique<AstroCamera>(camera, &frameReady, width, height, RAW_STILLS);
+    frame_source->start();
+
+    ImageWriterOptions writerOptions;
+    writerOptions.threads = IMAGE_WRITER_THREADS;
+    writerOptions.max_queue = IMAGE_WRITER_QUEUE_LENGTH;
+    writerOptions.policy = IMAGE_WRITER_QUEUE_POLICY;
+    writerOptions.format = IMAGE_WRITER_FORMAT;
+    writerOptions.stack = STACK_STILLS;
+    writerOptions.stacking.mode = STACK_MODE;
+    writerOptions.stacking.snapshot_interval = STACK_SNAPSHOT_INTERVAL;
+    writerOptions.calibration = CALIBRATION_MODE;
+    writerOptions.calibration_file = CALIBRATION_FILE;
+    writerOptions.hot_pixels = CORRECT_HOT_PIXELS;
+    writerOptions.hot_pixel_file = HOT_PIXEL_FILE;
+    start_image_processing(writerOptions);
+    start_stats_reporter(statsInterval, std::cout);
+
+    if (duration)
+        loop.timeout(duration);
     int ret = loop.exec();
-    astro_cam.reset();
+    stop_stats_reporter();
+    frame_source.reset();
 
     stop_image_processing();
 
-    cm->stop();
+    if (cm)
+        cm->stop();
 #if USE_SSD1351_DISPLAY || USE_TP28017_DISPLAY || USE_ILI9341_DISPLAY
+    display_worker.reset();
     display->displayOff();
 #endif
 
+#if FRAME_TRACE
+    print_trace_summary(std::cout);
+    if (!traceFile.empty() && !write_chrome_trace(traceFile))
+        std::cerr << "Failed to write " << traceFile << std::endl;
+#else
+    if (!traceFile.empty())
+        std::cerr << "Not writing " << traceFile << ", built without FRAME_TRACE" << std::endl;
+#endif
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,849 @@
+#include <string.h>
+#include "colour_convert.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+
+#define CLIP(X) ( (X) > 255 ? 255 : (X) < 0 ? 0 : X)
+
+#define Y_OFFSET   16
+#define UV_OFFSET 128
+#define YUV2RGB_11  298
+#define YUV2RGB_12   -1
+#define YUV2RGB_13  409
+#define YUV2RGB_22 -100
+#define YUV2RGB_23 -210
+#define YUV2RGB_32  519
+#define YUV2RGB_33    0
+
+// (x * DIV3_MUL) >> DIV3_SHIFT == x / 3 for every sum of three 8 bit channels
+#define DIV3_MUL   0xAAAB
+#define DIV3_SHIFT 17
+
+void convert_xrgb8888_to_bgr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        src += 4;
+        dst += 3;
+    }
+}
+
+void convert_yuyv_to_bgr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    int y, u, v;
+    int uv_r, uv_g, uv_b;
+    for (size_t i = 0; i < pixels; i += 2) {
+        u=src[1]-UV_OFFSET;
+        v=src[3]-UV_OFFSET;
+        uv_r=YUV2RGB_12*u+YUV2RGB_13*v;
+        uv_g=YUV2RGB_22*u+YUV2RGB_23*v;
+        uv_b=YUV2RGB_32*u+YUV2RGB_33*v;
+
+        // 1st pixel
+        y=YUV2RGB_11*(src[0] -Y_OFFSET);
+        dst[0] = CLIP((y + uv_r) >> 8); // r
+        dst[1] = CLIP((y + uv_g) >> 8); // g
+        dst[2] = CLIP((y + uv_b) >> 8); // b
+
+        // 2nd pixel
+        y=YUV2RGB_11*(src[2] -Y_OFFSET);
+        dst[3] = CLIP((y + uv_r) >> 8); // r
+        dst[4] = CLIP((y + uv_g) >> 8); // g
+        dst[5] = CLIP((y + uv_b) >> 8); // b
+
+        src += 4;
+        dst += 6;
+    }
+}
+
+void convert_xrgb8888_to_xxr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = src[0];
+        dst[1] = 0;
+        dst[2] = 0;
+        src += 4;
+        dst += 3;
+    }
+}
+
+void convert_yuyv_to_xxr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    int y, u, v;
+    int uv_r, uv_g, uv_b;
+    int r, g, b;
+    for (size_t i = 0; i < pixels; i += 2) {
+        u=src[1]-UV_OFFSET;
+        v=src[3]-UV_OFFSET;
+        uv_r=YUV2RGB_12*u+YUV2RGB_13*v;
+        uv_g=YUV2RGB_22*u+YUV2RGB_23*v;
+        uv_b=YUV2RGB_32*u+YUV2RGB_33*v;
+
+        // 1st pixel
+        y=YUV2RGB_11*(src[0] -Y_OFFSET);
+        r = CLIP((y + uv_r) >> 8);
+        g = CLIP((y + uv_g) >> 8);
+        b = CLIP((y + uv_b) >> 8);
+        dst[0] = (r + b + g) / 3;
+        dst[1] = 0;
+        dst[2] = 0;
+
+        // 2nd pixel
+        y=YUV2RGB_11*(src[2] -Y_OFFSET);
+        r = CLIP((y + uv_r) >> 8);
+        g = CLIP((y + uv_g) >> 8);
+        b = CLIP((y + uv_b) >> 8);
+        dst[3] = (r + b + g) / 3;
+        dst[4] = 0;
+        dst[5] = 0;
+
+        src += 4;
+        dst += 6;
+    }
+}
+
+void convert_bgr888_to_rgb888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        uint8_t first = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = first;
+        src += 3;
+        dst += 3;
+    }
+}
+
+// RGB888 is the XRGB8888 layout without the padding byte, so the bytes go across as they are
+void convert_rgb888_to_bgr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    memcpy(dst, src, pixels * 3);
+}
+
+void convert_rgb888_to_xxr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        dst[0] = src[0];
+        dst[1] = 0;
+        dst[2] = 0;
+        src += 3;
+        dst += 3;
+    }
+}
+
+static inline void store_565(uint8_t *dst, int first, int second, int third)
+{
+    uint16_t rgb = ((first & 0xF8) << 8) | ((second & 0xFC) << 3) | (third >> 3);
+    dst[0] = (uint8_t)(rgb >> 8);
+    dst[1] = (uint8_t)(rgb & 0xFF);
+}
+
+void convert_xrgb8888_to_bgr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        store_565(dst, src[0], src[1], src[2]);
+        src += 4;
+        dst += 2;
+    }
+}
+
+void convert_yuyv_to_bgr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    int y, u, v;
+    int uv_r, uv_g, uv_b;
+    for (size_t i = 0; i < pixels; i += 2) {
+        u=src[1]-UV_OFFSET;
+        v=src[3]-UV_OFFSET;
+        uv_r=YUV2RGB_12*u+YUV2RGB_13*v;
+        uv_g=YUV2RGB_22*u+YUV2RGB_23*v;
+        uv_b=YUV2RGB_32*u+YUV2RGB_33*v;
+
+        y=YUV2RGB_11*(src[0] -Y_OFFSET);
+        store_565(dst, CLIP((y + uv_r) >> 8), CLIP((y + uv_g) >> 8), CLIP((y + uv_b) >> 8));
+
+        y=YUV2RGB_11*(src[2] -Y_OFFSET);
+        store_565(dst + 2, CLIP((y + uv_r) >> 8), CLIP((y + uv_g) >> 8), CLIP((y + uv_b) >> 8));
+
+        src += 4;
+        dst += 4;
+    }
+}
+
+void convert_xrgb8888_to_xxr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        store_565(dst, src[0], 0, 0);
+        src += 4;
+        dst += 2;
+    }
+}
+
+void convert_yuyv_to_xxr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    int y, u, v;
+    int uv_r, uv_g, uv_b;
+    int r, g, b;
+    for (size_t i = 0; i < pixels; i += 2) {
+        u=src[1]-UV_OFFSET;
+        v=src[3]-UV_OFFSET;
+        uv_r=YUV2RGB_12*u+YUV2RGB_13*v;
+        uv_g=YUV2RGB_22*u+YUV2RGB_23*v;
+        uv_b=YUV2RGB_32*u+YUV2RGB_33*v;
+
+        for (int p = 0; p < 2; p++) {
+            y=YUV2RGB_11*(src[p * 2] -Y_OFFSET);
+            r = CLIP((y + uv_r) >> 8);
+            g = CLIP((y + uv_g) >> 8);
+            b = CLIP((y + uv_b) >> 8);
+            store_565(dst + p * 2, (r + b + g) / 3, 0, 0);
+        }
+
+        src += 4;
+        dst += 4;
+    }
+}
+
+void convert_rgb888_to_bgr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        store_565(dst, src[0], src[1], src[2]);
+        src += 3;
+        dst += 2;
+    }
+}
+
+void convert_rgb888_to_xxr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        store_565(dst, src[0], 0, 0);
+        src += 3;
+        dst += 2;
+    }
+}
+
+#if HAVE_NEON
+
+// Widens 8 Y/U/V samples and removes their offset
+static inline int16x8_t neon_offset(uint8x8_t x, int16_t offset)
+{
+    return vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(x)), vdupq_n_s16(offset));
+}
+
+static inline int32x4_t neon_uv_lo(int16x8_t u, int16x8_t v, int16_t cu, int16_t cv)
+{
+    return vmlal_n_s16(vmull_n_s16(vget_low_s16(u), cu), vget_low_s16(v), cv);
+}
+
+static inline int32x4_t neon_uv_hi(int16x8_t u, int16x8_t v, int16_t cu, int16_t cv)
+{
+    return vmlal_n_s16(vmull_n_s16(vget_high_s16(u), cu), vget_high_s16(v), cv);
+}
+
+// (y + uv) >> 8, clipped to 0..255, for 8 pixels sharing the chroma terms
+static inline uint8x8_t neon_channel(int16x8_t y, int32x4_t uv_lo, int32x4_t uv_hi)
+{
+    int32x4_t lo = vaddq_s32(vmull_n_s16(vget_low_s16(y), YUV2RGB_11), uv_lo);
+    int32x4_t hi = vaddq_s32(vmull_n_s16(vget_high_s16(y), YUV2RGB_11), uv_hi);
+    return vqmovun_s16(vcombine_s16(vqshrn_n_s32(lo, 8), vqshrn_n_s32(hi, 8)));
+}
+
+static inline uint8x16_t neon_interleave(uint8x8_t even, uint8x8_t odd)
+{
+    uint8x8x2_t zipped = vzip_u8(even, odd);
+    return vcombine_u8(zipped.val[0], zipped.val[1]);
+}
+
+// Converts 16 YUYV pixels to clipped R, G and B planes
+static inline uint8x16x3_t neon_yuyv_to_rgb(const uint8_t *src)
+{
+    uint8x8x4_t in = vld4_u8(src); // Y even, U, Y odd, V
+    int16x8_t y_even = neon_offset(in.val[0], Y_OFFSET);
+    int16x8_t y_odd = neon_offset(in.val[2], Y_OFFSET);
+    int16x8_t u = neon_offset(in.val[1], UV_OFFSET);
+    int16x8_t v = neon_offset(in.val[3], UV_OFFSET);
+
+    int32x4_t r_lo = neon_uv_lo(u, v, YUV2RGB_12, YUV2RGB_13);
+    int32x4_t r_hi = neon_uv_hi(u, v, YUV2RGB_12, YUV2RGB_13);
+    int32x4_t g_lo = neon_uv_lo(u, v, YUV2RGB_22, YUV2RGB_23);
+    int32x4_t g_hi = neon_uv_hi(u, v, YUV2RGB_22, YUV2RGB_23);
+    int32x4_t b_lo = neon_uv_lo(u, v, YUV2RGB_32, YUV2RGB_33);
+    int32x4_t b_hi = neon_uv_hi(u, v, YUV2RGB_32, YUV2RGB_33);
+
+    uint8x16x3_t rgb;
+    rgb.val[0] = neon_interleave(neon_channel(y_even, r_lo, r_hi), neon_channel(y_odd, r_lo, r_hi));
+    rgb.val[1] = neon_interleave(neon_channel(y_even, g_lo, g_hi), neon_channel(y_odd, g_lo, g_hi));
+    rgb.val[2] = neon_interleave(neon_channel(y_even, b_lo, b_hi), neon_channel(y_odd, b_lo, b_hi));
+    return rgb;
+}
+
+static inline uint8x8_t neon_average(uint8x8_t a, uint8x8_t b, uint8x8_t c)
+{
+    uint16x8_t sum = vaddw_u8(vaddl_u8(a, b), c);
+    uint32x4_t lo = vshrq_n_u32(vmull_n_u16(vget_low_u16(sum), DIV3_MUL), DIV3_SHIFT);
+    uint32x4_t hi = vshrq_n_u32(vmull_n_u16(vget_high_u16(sum), DIV3_MUL), DIV3_SHIFT);
+    return vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+}
+
+void convert_xrgb8888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t in = vld4q_u8(src);
+        uint8x16x3_t out = {{ in.val[0], in.val[1], in.val[2] }};
+        vst3q_u8(dst, out);
+        src += 64;
+        dst += 48;
+    }
+    convert_xrgb8888_to_bgr888_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        vst3q_u8(dst, neon_yuyv_to_rgb(src));
+        src += 32;
+        dst += 48;
+    }
+    convert_yuyv_to_bgr888_scalar(src, dst, pixels - i);
+}
+
+void convert_xrgb8888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t in = vld4q_u8(src);
+        uint8x16x3_t out = {{ in.val[0], zero, zero }};
+        vst3q_u8(dst, out);
+        src += 64;
+        dst += 48;
+    }
+    convert_xrgb8888_to_xxr888_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t rgb = neon_yuyv_to_rgb(src);
+        uint8x16_t lo = vcombine_u8(
+            neon_average(vget_low_u8(rgb.val[0]), vget_low_u8(rgb.val[1]), vget_low_u8(rgb.val[2])),
+            neon_average(vget_high_u8(rgb.val[0]), vget_high_u8(rgb.val[1]), vget_high_u8(rgb.val[2])));
+        uint8x16x3_t out = {{ lo, zero, zero }};
+        vst3q_u8(dst, out);
+        src += 32;
+        dst += 48;
+    }
+    convert_yuyv_to_xxr888_scalar(src, dst, pixels - i);
+}
+
+void convert_bgr888_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t in = vld3q_u8(src);
+        uint8x16x3_t out = {{ in.val[2], in.val[1], in.val[0] }};
+        vst3q_u8(dst, out);
+        src += 48;
+        dst += 48;
+    }
+    convert_bgr888_to_rgb888_scalar(src, dst, pixels - i);
+}
+
+// Packs 16 pixels into big endian 5:6:5
+static inline void neon_store_565(uint8_t *dst, uint8x16_t first, uint8x16_t second, uint8x16_t third)
+{
+    uint8x16x2_t out;
+    out.val[0] = vorrq_u8(vandq_u8(first, vdupq_n_u8(0xF8)), vshrq_n_u8(second, 5));
+    out.val[1] = vorrq_u8(vshlq_n_u8(vandq_u8(second, vdupq_n_u8(0x1C)), 3), vshrq_n_u8(third, 3));
+    vst2q_u8(dst, out);
+}
+
+void convert_xrgb8888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t in = vld4q_u8(src);
+        neon_store_565(dst, in.val[0], in.val[1], in.val[2]);
+        src += 64;
+        dst += 32;
+    }
+    convert_xrgb8888_to_bgr565_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t rgb = neon_yuyv_to_rgb(src);
+        neon_store_565(dst, rgb.val[0], rgb.val[1], rgb.val[2]);
+        src += 32;
+        dst += 32;
+    }
+    convert_yuyv_to_bgr565_scalar(src, dst, pixels - i);
+}
+
+void convert_xrgb8888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x4_t in = vld4q_u8(src);
+        neon_store_565(dst, in.val[0], zero, zero);
+        src += 64;
+        dst += 32;
+    }
+    convert_xrgb8888_to_xxr565_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t rgb = neon_yuyv_to_rgb(src);
+        uint8x16_t grey = vcombine_u8(
+            neon_average(vget_low_u8(rgb.val[0]), vget_low_u8(rgb.val[1]), vget_low_u8(rgb.val[2])),
+            neon_average(vget_high_u8(rgb.val[0]), vget_high_u8(rgb.val[1]), vget_high_u8(rgb.val[2])));
+        neon_store_565(dst, grey, zero, zero);
+        src += 32;
+        dst += 32;
+    }
+    convert_yuyv_to_xxr565_scalar(src, dst, pixels - i);
+}
+
+void convert_rgb888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_bgr888_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t in = vld3q_u8(src);
+        uint8x16x3_t out = {{ in.val[0], zero, zero }};
+        vst3q_u8(dst, out);
+        src += 48;
+        dst += 48;
+    }
+    convert_rgb888_to_xxr888_scalar(src, dst, pixels - i);
+}
+
+void convert_rgb888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t in = vld3q_u8(src);
+        neon_store_565(dst, in.val[0], in.val[1], in.val[2]);
+        src += 48;
+        dst += 32;
+    }
+    convert_rgb888_to_bgr565_scalar(src, dst, pixels - i);
+}
+
+void convert_rgb888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        uint8x16x3_t in = vld3q_u8(src);
+        neon_store_565(dst, in.val[0], zero, zero);
+        src += 48;
+        dst += 32;
+    }
+    convert_rgb888_to_xxr565_scalar(src, dst, pixels - i);
+}
+
+#elif HAVE_SSE2
+
+// Pairs of 16 bit coefficients for _mm_madd_epi16, low word first
+static inline __m128i sse2_pair(int16_t lo, int16_t hi)
+{
+    return _mm_set_epi16(hi, lo, hi, lo, hi, lo, hi, lo);
+}
+
+// Compacts 4 pixels of 4 bytes into 12 bytes of 3 bytes per pixel
+static inline __m128i sse2_pack_rgbx(__m128i x)
+{
+    const __m128i low3 = _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff);
+    const __m128i high3 = _mm_set_epi32(0x0000ffff, 0xff000000, 0x0000ffff, 0xff000000);
+    const __m128i lane0 = _mm_set_epi32(0, 0, 0x0000ffff, 0xffffffff);
+    const __m128i lane1 = _mm_set_epi32(0, 0xffffffff, 0xffff0000, 0);
+    __m128i t = _mm_or_si128(_mm_and_si128(x, low3), _mm_and_si128(_mm_srli_epi64(x, 8), high3));
+    return _mm_or_si128(_mm_and_si128(t, lane0), _mm_and_si128(_mm_srli_si128(t, 2), lane1));
+}
+
+static inline void sse2_store12(uint8_t *dst, __m128i x)
+{
+    _mm_storel_epi64((__m128i *)dst, x);
+    uint32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+    memcpy(dst + 8, &tail, 4);
+}
+
+// (y + uv) >> 8 for 8 pixels given even/odd luma and shared chroma terms
+static inline __m128i sse2_channel(__m128i y_even, __m128i y_odd, __m128i uv)
+{
+    __m128i even = _mm_srai_epi32(_mm_add_epi32(y_even, uv), 8);
+    __m128i odd = _mm_srai_epi32(_mm_add_epi32(y_odd, uv), 8);
+    return _mm_packs_epi32(_mm_unpacklo_epi32(even, odd), _mm_unpackhi_epi32(even, odd));
+}
+
+// Converts 8 YUYV pixels to unclipped 16 bit R, G and B
+static inline void sse2_yuyv_to_rgb(const uint8_t *src, __m128i &r, __m128i &g, __m128i &b)
+{
+    __m128i in = _mm_loadu_si128((const __m128i *)src);
+    __m128i y = _mm_sub_epi16(_mm_and_si128(in, _mm_set1_epi16(0x00ff)), _mm_set1_epi16(Y_OFFSET));
+    __m128i uv = _mm_sub_epi16(_mm_srli_epi16(in, 8), _mm_set1_epi16(UV_OFFSET));
+    __m128i y_even = _mm_madd_epi16(y, sse2_pair(YUV2RGB_11, 0));
+    __m128i y_odd = _mm_madd_epi16(y, sse2_pair(0, YUV2RGB_11));
+    r = sse2_channel(y_even, y_odd, _mm_madd_epi16(uv, sse2_pair(YUV2RGB_12, YUV2RGB_13)));
+    g = sse2_channel(y_even, y_odd, _mm_madd_epi16(uv, sse2_pair(YUV2RGB_22, YUV2RGB_23)));
+    b = sse2_channel(y_even, y_odd, _mm_madd_epi16(uv, sse2_pair(YUV2RGB_32, YUV2RGB_33)));
+}
+
+// Writes 8 pixels from 8 bit channel vectors (low 8 bytes of each)
+static inline void sse2_store_rgb(uint8_t *dst, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i rg = _mm_unpacklo_epi8(r, g);
+    __m128i bx = _mm_unpacklo_epi8(b, zero);
+    sse2_store12(dst, sse2_pack_rgbx(_mm_unpacklo_epi16(rg, bx)));
+    sse2_store12(dst + 12, sse2_pack_rgbx(_mm_unpackhi_epi16(rg, bx)));
+}
+
+// Packs 8 pixels of 16 bit components (0..255) into big endian 5:6:5
+static inline void sse2_store_565(uint8_t *dst, __m128i first, __m128i second, __m128i third)
+{
+    __m128i rgb = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(first, _mm_set1_epi16(0xF8)), 8),
+                  _mm_or_si128(_mm_slli_epi16(_mm_and_si128(second, _mm_set1_epi16(0xFC)), 3),
+                               _mm_srli_epi16(third, 3)));
+    _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_slli_epi16(rgb, 8), _mm_srli_epi16(rgb, 8)));
+}
+
+// Splits 8 XRGB8888 pixels into 16 bit planes of their first three bytes
+static inline void sse2_unpack_xrgb(const uint8_t *src, __m128i &first, __m128i &second, __m128i &third)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i lo = _mm_loadu_si128((const __m128i *)src);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(src + 16));
+    first = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+    second = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask), _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+    third = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask), _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+}
+
+static inline __m128i sse2_clip(__m128i x)
+{
+    return _mm_min_epi16(_mm_max_epi16(x, _mm_setzero_si128()), _mm_set1_epi16(255));
+}
+
+static inline __m128i sse2_average(__m128i r, __m128i g, __m128i b)
+{
+    __m128i sum = _mm_add_epi16(_mm_add_epi16(sse2_clip(r), sse2_clip(g)), sse2_clip(b));
+    return _mm_srli_epi16(_mm_mulhi_epu16(sum, _mm_set1_epi16((int16_t)DIV3_MUL)), DIV3_SHIFT - 16);
+}
+
+#if HAVE_AVX2
+
+AVX2 static inline __m256i avx2_pair(int16_t lo, int16_t hi)
+{
+    return _mm256_set1_epi32((uint16_t)lo | ((uint32_t)(uint16_t)hi << 16));
+}
+
+AVX2 static inline __m256i avx2_channel(__m256i y_even, __m256i y_odd, __m256i uv)
+{
+    __m256i even = _mm256_srai_epi32(_mm256_add_epi32(y_even, uv), 8);
+    __m256i odd = _mm256_srai_epi32(_mm256_add_epi32(y_odd, uv), 8);
+    return _mm256_packs_epi32(_mm256_unpacklo_epi32(even, odd), _mm256_unpackhi_epi32(even, odd));
+}
+
+// Converts 16 YUYV pixels, pixels 0-7 in the low lane and 8-15 in the high lane
+AVX2 static inline void avx2_yuyv_to_rgb(const uint8_t *src, __m256i &r, __m256i &g, __m256i &b)
+{
+    __m256i in = _mm256_loadu_si256((const __m256i *)src);
+    __m256i y = _mm256_sub_epi16(_mm256_and_si256(in, _mm256_set1_epi16(0x00ff)), _mm256_set1_epi16(Y_OFFSET));
+    __m256i uv = _mm256_sub_epi16(_mm256_srli_epi16(in, 8), _mm256_set1_epi16(UV_OFFSET));
+    __m256i y_even = _mm256_madd_epi16(y, avx2_pair(YUV2RGB_11, 0));
+    __m256i y_odd = _mm256_madd_epi16(y, avx2_pair(0, YUV2RGB_11));
+    r = avx2_channel(y_even, y_odd, _mm256_madd_epi16(uv, avx2_pair(YUV2RGB_12, YUV2RGB_13)));
+    g = avx2_channel(y_even, y_odd, _mm256_madd_epi16(uv, avx2_pair(YUV2RGB_22, YUV2RGB_23)));
+    b = avx2_channel(y_even, y_odd, _mm256_madd_epi16(uv, avx2_pair(YUV2RGB_32, YUV2RGB_33)));
+}
+
+// Writes 16 pixels given 8 bit channels in the low 8 bytes of each lane
+AVX2 static inline void avx2_store_rgb(uint8_t *dst, __m256i r, __m256i g, __m256i b)
+{
+    const __m256i compact = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    __m256i rg = _mm256_unpacklo_epi8(r, g);
+    __m256i bx = _mm256_unpacklo_epi8(b, _mm256_setzero_si256());
+    __m256i lo = _mm256_shuffle_epi8(_mm256_unpacklo_epi16(rg, bx), compact);
+    __m256i hi = _mm256_shuffle_epi8(_mm256_unpackhi_epi16(rg, bx), compact);
+    sse2_store12(dst, _mm256_castsi256_si128(lo));
+    sse2_store12(dst + 12, _mm256_castsi256_si128(hi));
+    sse2_store12(dst + 24, _mm256_extracti128_si256(lo, 1));
+    sse2_store12(dst + 36, _mm256_extracti128_si256(hi, 1));
+}
+
+AVX2 static void convert_yuyv_to_bgr888_avx2(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m256i r, g, b;
+        avx2_yuyv_to_rgb(src, r, g, b);
+        __m256i rg = _mm256_packus_epi16(r, g);
+        __m256i bx = _mm256_packus_epi16(b, b);
+        avx2_store_rgb(dst, rg, _mm256_srli_si256(rg, 8), bx);
+        src += 32;
+        dst += 48;
+    }
+    convert_yuyv_to_bgr888_scalar(src, dst, pixels - i);
+}
+
+AVX2 static void convert_yuyv_to_xxr888_avx2(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max = _mm256_set1_epi16(255);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m256i r, g, b;
+        avx2_yuyv_to_rgb(src, r, g, b);
+        r = _mm256_min_epi16(_mm256_max_epi16(r, zero), max);
+        g = _mm256_min_epi16(_mm256_max_epi16(g, zero), max);
+        b = _mm256_min_epi16(_mm256_max_epi16(b, zero), max);
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(r, g), b);
+        __m256i average = _mm256_srli_epi16(_mm256_mulhi_epu16(sum, _mm256_set1_epi16((int16_t)DIV3_MUL)), DIV3_SHIFT - 16);
+        avx2_store_rgb(dst, _mm256_packus_epi16(average, zero), zero, zero);
+        src += 32;
+        dst += 48;
+    }
+    convert_yuyv_to_xxr888_scalar(src, dst, pixels - i);
+}
+
+#endif
+
+void convert_xrgb8888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        sse2_store12(dst, sse2_pack_rgbx(_mm_loadu_si128((const __m128i *)src)));
+        src += 16;
+        dst += 12;
+    }
+    convert_xrgb8888_to_bgr888_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+#if HAVE_AVX2
+    if (cpu_has_avx2())
+        return convert_yuyv_to_bgr888_avx2(src, dst, pixels);
+#endif
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i r, g, b;
+        sse2_yuyv_to_rgb(src, r, g, b);
+        __m128i rg = _mm_packus_epi16(r, g);
+        sse2_store_rgb(dst, rg, _mm_srli_si128(rg, 8), _mm_packus_epi16(b, b));
+        src += 16;
+        dst += 24;
+    }
+    convert_yuyv_to_bgr888_scalar(src, dst, pixels - i);
+}
+
+void convert_xrgb8888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const __m128i first = _mm_set1_epi32(0xff);
+    size_t i = 0;
+    for (; i + 4 <= pixels; i += 4) {
+        __m128i in = _mm_loadu_si128((const __m128i *)src);
+        sse2_store12(dst, sse2_pack_rgbx(_mm_and_si128(in, first)));
+        src += 16;
+        dst += 12;
+    }
+    convert_xrgb8888_to_xxr888_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+#if HAVE_AVX2
+    if (cpu_has_avx2())
+        return convert_yuyv_to_xxr888_avx2(src, dst, pixels);
+#endif
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i r, g, b;
+        sse2_yuyv_to_rgb(src, r, g, b);
+        sse2_store_rgb(dst, _mm_packus_epi16(sse2_average(r, g, b), zero), zero, zero);
+        src += 16;
+        dst += 24;
+    }
+    convert_yuyv_to_xxr888_scalar(src, dst, pixels - i);
+}
+
+void convert_xrgb8888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i first, second, third;
+        sse2_unpack_xrgb(src, first, second, third);
+        sse2_store_565(dst, first, second, third);
+        src += 32;
+        dst += 16;
+    }
+    convert_xrgb8888_to_bgr565_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i r, g, b;
+        sse2_yuyv_to_rgb(src, r, g, b);
+        sse2_store_565(dst, sse2_clip(r), sse2_clip(g), sse2_clip(b));
+        src += 16;
+        dst += 16;
+    }
+    convert_yuyv_to_bgr565_scalar(src, dst, pixels - i);
+}
+
+void convert_xrgb8888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i first, second, third;
+        sse2_unpack_xrgb(src, first, second, third);
+        sse2_store_565(dst, first, zero, zero);
+        src += 32;
+        dst += 16;
+    }
+    convert_xrgb8888_to_xxr565_scalar(src, dst, pixels - i);
+}
+
+void convert_yuyv_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        __m128i r, g, b;
+        sse2_yuyv_to_rgb(src, r, g, b);
+        sse2_store_565(dst, sse2_average(r, g, b), zero, zero);
+        src += 16;
+        dst += 16;
+    }
+    convert_yuyv_to_xxr565_scalar(src, dst, pixels - i);
+}
+
+// SSE2 has no byte shuffle, the scalar loop is as quick as unpacking and repacking
+void convert_bgr888_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_bgr888_to_rgb888_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_bgr888_scalar(src, dst, pixels);
+}
+
+// As above, 3 byte pixels don't split into SSE2 lanes without a shuffle
+void convert_rgb888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_xxr888_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_bgr565_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_xxr565_scalar(src, dst, pixels);
+}
+
+#else
+
+void convert_xrgb8888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_xrgb8888_to_bgr888_scalar(src, dst, pixels);
+}
+
+void convert_bgr888_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_bgr888_to_rgb888_scalar(src, dst, pixels);
+}
+
+void convert_yuyv_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_yuyv_to_bgr888_scalar(src, dst, pixels);
+}
+
+void convert_xrgb8888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_xrgb8888_to_xxr888_scalar(src, dst, pixels);
+}
+
+void convert_yuyv_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_yuyv_to_xxr888_scalar(src, dst, pixels);
+}
+
+void convert_xrgb8888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_xrgb8888_to_bgr565_scalar(src, dst, pixels);
+}
+
+void convert_yuyv_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_yuyv_to_bgr565_scalar(src, dst, pixels);
+}
+
+void convert_xrgb8888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_xrgb8888_to_xxr565_scalar(src, dst, pixels);
+}
+
+void convert_yuyv_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_yuyv_to_xxr565_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_bgr888_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_xxr888_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_bgr565_scalar(src, dst, pixels);
+}
+
+void convert_rgb888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    convert_rgb888_to_xxr565_scalar(src, dst, pixels);
+}
+
+#endif
+
+void convert_rows(ConvertKernel kernel, const uint8_t *src, size_t srcStride,
+                  uint8_t *dst, size_t dstBytesPerPixel, size_t width, size_t rows)
+{
+    const size_t dstStride = width * dstBytesPerPixel;
+    parallel_for(rows, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++)
+            kernel(src + y * srcStride, dst + y * dstStride, width);
+    });
+}
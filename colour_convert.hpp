@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Pixel format conversion kernels used by Image for the viewfinder path.
+ *
+ * Each kernel converts `pixels` source pixels into 3 bytes per pixel at
+ * `dst`, which must have room for pixels * 3 bytes. The YUYV kernels
+ * expect an even pixel count. The plain entry points pick the widest
+ * vector implementation available (NEON on the Pi, AVX2 or SSE2 on x86)
+ * and produce output byte-for-byte identical to the *_scalar versions.
+ */
+void convert_xrgb8888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_xrgb8888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+/*
+ * 16 bit versions for panels in RGB565 mode, 2 bytes per pixel, most
+ * significant byte first as the panels expect it on the wire. The three
+ * components go into the 5:6:5 fields in the same order the 888 kernels
+ * write them, so colours come out the same in either panel mode.
+ */
+void convert_xrgb8888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_xrgb8888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+/*
+ * The same outputs from 3 byte RGB888, as the Pi's viewfinder delivers
+ * it: XRGB8888's byte order without the padding byte.
+ */
+void convert_rgb888_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_rgb888_to_xxr888(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_rgb888_to_bgr565(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_rgb888_to_xxr565(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+// Swaps the first and third byte of each 3 byte pixel, for RGB888 stills going to the JPEG encoder
+void convert_bgr888_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+// Scalar reference implementations
+void convert_xrgb8888_to_bgr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_bgr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_xrgb8888_to_xxr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_xxr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_xrgb8888_to_bgr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_bgr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_xrgb8888_to_xxr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_yuyv_to_xxr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_bgr888_to_rgb888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_rgb888_to_bgr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_rgb888_to_xxr888_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_rgb888_to_bgr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+void convert_rgb888_to_xxr565_scalar(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+using ConvertKernel = void (*)(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+/*
+ * Runs a kernel over rows rows of width pixels, reading source rows
+ * srcStride bytes apart so line padding is skipped, and writing packed
+ * rows of width * dstBytesPerPixel. Every row goes to the kernel as one
+ * contiguous span, so the vector loops only fall back to scalar code for
+ * the last few pixels of each row. Rows are split into bands across the
+ * cores.
+ */
+void convert_rows(ConvertKernel kernel, const uint8_t *src, size_t srcStride,
+                  uint8_t *dst, size_t dstBytesPerPixel, size_t width, size_t rows);
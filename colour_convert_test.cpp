@@ -0,0 +1,191 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "colour_convert.hpp"
+
+// Bytes past the end of each output that must come back untouched
+#define GUARD_BYTES 64
+#define GUARD_VALUE 0xA5
+// Every length up to this, so each vector loop's scalar tail is hit at every offset
+#define MAX_TAIL_PIXELS 130
+
+struct KernelPair
+{
+    const char *name;
+    ConvertKernel kernel;
+    ConvertKernel reference;
+    size_t srcBytesPerPixel;
+    size_t dstBytesPerPixel;
+    bool yuyv;
+};
+
+static const KernelPair kernels[] = {
+    {"xrgb8888_to_bgr888", convert_xrgb8888_to_bgr888, convert_xrgb8888_to_bgr888_scalar, 4, 3, false},
+    {"yuyv_to_bgr888", convert_yuyv_to_bgr888, convert_yuyv_to_bgr888_scalar, 2, 3, true},
+    {"xrgb8888_to_xxr888", convert_xrgb8888_to_xxr888, convert_xrgb8888_to_xxr888_scalar, 4, 3, false},
+    {"yuyv_to_xxr888", convert_yuyv_to_xxr888, convert_yuyv_to_xxr888_scalar, 2, 3, true},
+    {"xrgb8888_to_bgr565", convert_xrgb8888_to_bgr565, convert_xrgb8888_to_bgr565_scalar, 4, 2, false},
+    {"yuyv_to_bgr565", convert_yuyv_to_bgr565, convert_yuyv_to_bgr565_scalar, 2, 2, true},
+    {"xrgb8888_to_xxr565", convert_xrgb8888_to_xxr565, convert_xrgb8888_to_xxr565_scalar, 4, 2, false},
+    {"yuyv_to_xxr565", convert_yuyv_to_xxr565, convert_yuyv_to_xxr565_scalar, 2, 2, true},
+    {"bgr888_to_rgb888", convert_bgr888_to_rgb888, convert_bgr888_to_rgb888_scalar, 3, 3, false},
+    {"rgb888_to_bgr888", convert_rgb888_to_bgr888, convert_rgb888_to_bgr888_scalar, 3, 3, false},
+    {"rgb888_to_xxr888", convert_rgb888_to_xxr888, convert_rgb888_to_xxr888_scalar, 3, 3, false},
+    {"rgb888_to_bgr565", convert_rgb888_to_bgr565, convert_rgb888_to_bgr565_scalar, 3, 2, false},
+    {"rgb888_to_xxr565", convert_rgb888_to_xxr565, convert_rgb888_to_xxr565_scalar, 3, 2, false},
+};
+
+static std::vector<uint8_t> random_bytes(size_t length, uint32_t seed)
+{
+    std::vector<uint8_t> data(length);
+    uint32_t state = seed | 1;
+    for (auto &byte : data)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = (uint8_t)state;
+    }
+    return data;
+}
+
+// Runs both versions over src and reports the first byte they disagree on
+static bool matches(const KernelPair &pair, const std::vector<uint8_t> &src, size_t pixels, const char *what)
+{
+    const size_t length = pixels * pair.dstBytesPerPixel;
+    std::vector<uint8_t> expected(length + GUARD_BYTES, GUARD_VALUE);
+    std::vector<uint8_t> actual(length + GUARD_BYTES, GUARD_VALUE);
+    pair.reference(src.data(), expected.data(), pixels);
+    pair.kernel(src.data(), actual.data(), pixels);
+
+    for (size_t i = 0; i < length + GUARD_BYTES; i++)
+    {
+        if (actual[i] != expected[i])
+        {
+            std::cerr << pair.name << ": " << what << " over " << pixels << " pixels differs at byte " << i
+                      << " (pixel " << i / pair.dstBytesPerPixel << "), got " << (int)actual[i]
+                      << " expected " << (int)expected[i] << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool check_tails(const KernelPair &pair)
+{
+    for (size_t pixels = 0; pixels <= MAX_TAIL_PIXELS; pixels++)
+    {
+        if (pair.yuyv && pixels % 2)
+            continue;
+        // an unaligned source too, the kernels only use unaligned loads
+        for (size_t offset = 0; offset < 2; offset++)
+        {
+            std::vector<uint8_t> src = random_bytes(offset + pixels * pair.srcBytesPerPixel, pixels * 2 + offset + 1);
+            std::vector<uint8_t> shifted(src.begin() + offset, src.end());
+            if (!matches(pair, shifted, pixels, offset ? "unaligned tail" : "tail"))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Every Y for every U/V pair: a row of 128 YUYV macropixels per (U, V)
+static bool check_yuv_sweep(const KernelPair &pair)
+{
+    const size_t pixels = 256;
+    std::vector<uint8_t> src(pixels * 2);
+    for (unsigned int u = 0; u < 256; u++)
+    {
+        for (unsigned int v = 0; v < 256; v++)
+        {
+            for (size_t i = 0; i < pixels / 2; i++)
+            {
+                src[i * 4 + 0] = (uint8_t)(i * 2);
+                src[i * 4 + 1] = (uint8_t)u;
+                src[i * 4 + 2] = (uint8_t)(i * 2 + 1);
+                src[i * 4 + 3] = (uint8_t)v;
+            }
+            if (!matches(pair, src, pixels, "YUV sweep"))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Strided rows through convert_rows, as Image uses the kernels
+static bool check_rows(const KernelPair &pair)
+{
+    const size_t width = 37 * 2, rows = 29;
+    const size_t srcStride = width * pair.srcBytesPerPixel + 24;
+    const size_t dstStride = width * pair.dstBytesPerPixel;
+    std::vector<uint8_t> src = random_bytes(srcStride * rows, 7);
+    std::vector<uint8_t> expected(dstStride * rows);
+    std::vector<uint8_t> actual(dstStride * rows);
+
+    for (size_t y = 0; y < rows; y++)
+        pair.reference(src.data() + y * srcStride, expected.data() + y * dstStride, width);
+    convert_rows(pair.kernel, src.data(), srcStride, actual.data(), pair.dstBytesPerPixel, width, rows);
+
+    if (actual != expected)
+    {
+        std::cerr << pair.name << ": convert_rows output differs from the scalar rows" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Each RGB888 kernel must give what its XRGB8888 counterpart gives for the same pixels
+static const struct
+{
+    const char *name;
+    ConvertKernel rgb888;
+    ConvertKernel xrgb8888;
+    size_t dstBytesPerPixel;
+} sameOutput[] = {
+    {"rgb888_to_bgr888 as xrgb8888", convert_rgb888_to_bgr888, convert_xrgb8888_to_bgr888, 3},
+    {"rgb888_to_xxr888 as xrgb8888", convert_rgb888_to_xxr888, convert_xrgb8888_to_xxr888, 3},
+    {"rgb888_to_bgr565 as xrgb8888", convert_rgb888_to_bgr565, convert_xrgb8888_to_bgr565, 2},
+    {"rgb888_to_xxr565 as xrgb8888", convert_rgb888_to_xxr565, convert_xrgb8888_to_xxr565, 2},
+};
+
+static bool check_against_xrgb8888(ConvertKernel rgb888, ConvertKernel xrgb8888, size_t dstBytesPerPixel)
+{
+    for (size_t pixels = 0; pixels <= MAX_TAIL_PIXELS; pixels++)
+    {
+        std::vector<uint8_t> xrgb = random_bytes(pixels * 4, pixels + 3);
+        std::vector<uint8_t> rgb(pixels * 3);
+        for (size_t i = 0; i < pixels; i++)
+            memcpy(&rgb[i * 3], &xrgb[i * 4], 3);
+
+        std::vector<uint8_t> expected(pixels * dstBytesPerPixel + GUARD_BYTES, GUARD_VALUE);
+        std::vector<uint8_t> actual(pixels * dstBytesPerPixel + GUARD_BYTES, GUARD_VALUE);
+        xrgb8888(xrgb.data(), expected.data(), pixels);
+        rgb888(rgb.data(), actual.data(), pixels);
+        if (actual != expected)
+            return false;
+    }
+    return true;
+}
+
+int main()
+{
+    int failures = 0;
+    for (const KernelPair &pair : kernels)
+    {
+        bool ok = check_tails(pair) && check_rows(pair);
+        if (ok && pair.yuyv)
+            ok = check_yuv_sweep(pair);
+        std::cout << (ok ? "ok   " : "FAIL ") << pair.name << std::endl;
+        if (!ok)
+            failures++;
+    }
+    for (const auto &pair : sameOutput)
+    {
+        bool ok = check_against_xrgb8888(pair.rgb888, pair.xrgb8888, pair.dstBytesPerPixel);
+        std::cout << (ok ? "ok   " : "FAIL ") << pair.name << std::endl;
+        if (!ok)
+            failures++;
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
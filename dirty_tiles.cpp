@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <string.h>
+#include "dirty_tiles.hpp"
+#include "simd.hpp"
+
+#define TILE_SIZE 16
+// past this share of changed tiles a single full frame write is cheaper
+#define MAX_DIRTY_FRACTION 0.6
+
+static bool bytes_equal(const uint8_t *a, const uint8_t *b, size_t count)
+{
+    size_t i = 0;
+#if HAVE_NEON
+    uint8x16_t diff = vdupq_n_u8(0);
+    for (; i + 16 <= count; i += 16)
+        diff = vorrq_u8(diff, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    uint64x2_t lanes = vreinterpretq_u64_u8(diff);
+    if (vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1))
+        return false;
+#elif HAVE_SSE2
+    __m128i diff = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        diff = _mm_or_si128(diff, _mm_xor_si128(x, y));
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff)
+        return false;
+#endif
+    return memcmp(a + i, b + i, count - i) == 0;
+}
+
+DirtyTiles::DirtyTiles(uint16_t width, uint16_t height, uint8_t bytesPerPixel)
+    : m_width(width), m_height(height), m_bytes_per_pixel(bytesPerPixel),
+      m_tiles_x((width + TILE_SIZE - 1) / TILE_SIZE), m_tiles_y((height + TILE_SIZE - 1) / TILE_SIZE),
+      m_previous((size_t)width * height * bytesPerPixel), m_dirty(m_tiles_x)
+{
+}
+
+bool DirtyTiles::matches(uint16_t width, uint16_t height, uint8_t bytesPerPixel) const
+{
+    return m_width == width && m_height == height && m_bytes_per_pixel == bytesPerPixel;
+}
+
+void DirtyTiles::invalidate()
+{
+    m_valid = false;
+}
+
+const std::vector<DirtyRect> &DirtyTiles::rects() const
+{
+    return m_rects;
+}
+
+bool DirtyTiles::update(libcamera::Span<const uint8_t> frame)
+{
+    m_rects.clear();
+    if (frame.size() < m_previous.size())
+    {
+        m_valid = false;
+        return false;
+    }
+    if (!m_valid)
+    {
+        memcpy(m_previous.data(), frame.data(), m_previous.size());
+        m_valid = true;
+        return false;
+    }
+
+    const size_t rowBytes = (size_t)m_width * m_bytes_per_pixel;
+    const size_t tileBytes = TILE_SIZE * m_bytes_per_pixel;
+    size_t dirtyTiles = 0;
+    // rects that end on the tile row above, which a matching run can extend downwards
+    size_t firstOpen = 0;
+
+    for (uint16_t ty = 0; ty < m_tiles_y; ty++)
+    {
+        const uint16_t y0 = ty * TILE_SIZE;
+        const uint16_t rows = std::min<uint16_t>(TILE_SIZE, m_height - y0);
+
+        std::fill(m_dirty.begin(), m_dirty.end(), false);
+        for (uint16_t y = y0; y < y0 + rows; y++)
+        {
+            const uint8_t *now = frame.data() + y * rowBytes;
+            const uint8_t *before = m_previous.data() + y * rowBytes;
+            for (uint16_t tx = 0; tx < m_tiles_x; tx++)
+            {
+                if (m_dirty[tx])
+                    continue;
+                size_t offset = tx * tileBytes;
+                m_dirty[tx] = !bytes_equal(now + offset, before + offset, std::min(tileBytes, rowBytes - offset));
+            }
+        }
+
+        size_t rowStart = m_rects.size();
+        for (uint16_t tx = 0; tx < m_tiles_x;)
+        {
+            if (!m_dirty[tx])
+            {
+                tx++;
+                continue;
+            }
+            uint16_t run = tx;
+            while (run < m_tiles_x && m_dirty[run])
+                run++;
+            dirtyTiles += run - tx;
+
+            DirtyRect rect;
+            rect.x = tx * TILE_SIZE;
+            rect.y = y0;
+            rect.w = std::min<int>(run * TILE_SIZE, m_width) - rect.x;
+            rect.h = rows;
+            for (uint16_t y = y0; y < y0 + rows; y++)
+            {
+                size_t offset = y * rowBytes + rect.x * m_bytes_per_pixel;
+                memcpy(m_previous.data() + offset, frame.data() + offset, rect.w * m_bytes_per_pixel);
+            }
+
+            auto above = std::find_if(m_rects.begin() + firstOpen, m_rects.begin() + rowStart,
+                                      [&rect](const DirtyRect &r) { return r.x == rect.x && r.w == rect.w; });
+            if (above != m_rects.begin() + rowStart)
+            {
+                // carry the extended rect into this row so the next row can extend it again
+                DirtyRect merged = *above;
+                merged.h += rect.h;
+                m_rects.erase(above);
+                rowStart--;
+                m_rects.push_back(merged);
+            }
+            else
+            {
+                m_rects.push_back(rect);
+            }
+            tx = run;
+        }
+        firstOpen = rowStart;
+    }
+
+    return dirtyTiles <= MAX_DIRTY_FRACTION * m_tiles_x * m_tiles_y;
+}
+
+libcamera::Span<uint8_t> DirtyTiles::rectData(libcamera::Span<uint8_t> frame, const DirtyRect &rect)
+{
+    const size_t rowBytes = (size_t)m_width * m_bytes_per_pixel;
+    const size_t rectRowBytes = (size_t)rect.w * m_bytes_per_pixel;
+    uint8_t *start = frame.data() + rect.y * rowBytes + rect.x * m_bytes_per_pixel;
+    // full width rects are already contiguous in the frame
+    if (rect.w == m_width)
+        return libcamera::Span<uint8_t>(start, rectRowBytes * rect.h);
+
+    m_scratch.resize(rectRowBytes * rect.h);
+    for (uint16_t y = 0; y < rect.h; y++)
+        memcpy(m_scratch.data() + y * rectRowBytes, start + y * rowBytes, rectRowBytes);
+    return libcamera::Span<uint8_t>(m_scratch.data(), m_scratch.size());
+}
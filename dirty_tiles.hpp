@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <libcamera/base/span.h>
+
+struct DirtyRect
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+};
+
+/*
+ * Tracks which parts of a display changed between frames. update() keeps a
+ * copy of the last frame sent, compares the new one against it tile by
+ * tile and merges the changed tiles into as few rectangles as it can:
+ * runs of tiles along a row first, then identical runs on the rows below.
+ * Used by the displays' delta mode so a mostly static star field only
+ * sends what moved.
+ */
+class DirtyTiles {
+    uint16_t m_width;
+    uint16_t m_height;
+    uint8_t m_bytes_per_pixel;
+    uint16_t m_tiles_x;
+    uint16_t m_tiles_y;
+    bool m_valid = false;
+    std::vector<uint8_t> m_previous;
+    std::vector<bool> m_dirty;
+    std::vector<DirtyRect> m_rects;
+    std::vector<uint8_t> m_scratch;
+
+    public:
+        DirtyTiles(uint16_t width, uint16_t height, uint8_t bytesPerPixel);
+
+        // Records the frame and returns false when it should be sent whole
+        bool update(libcamera::Span<const uint8_t> frame);
+        const std::vector<DirtyRect> &rects() const;
+        // The rectangle's pixels as one contiguous run, ready to send
+        libcamera::Span<uint8_t> rectData(libcamera::Span<uint8_t> frame, const DirtyRect &rect);
+        // Forget the last frame, e.g. after the screen was filled
+        void invalidate();
+
+        bool matches(uint16_t width, uint16_t height, uint8_t bytesPerPixel) const;
+};
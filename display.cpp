@@ -1,35 +1,21 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <wiringPi.h>
-#include <iostream>
 #include "display.hpp"
 
-Display::Display(const char *spi_dev, int spi_speed, int cs, int dc, int rst)
-    : m_cs(cs), m_dc(dc), m_rst(rst)
+Display::Display(std::unique_ptr<DisplayBus> bus, int spi_speed)
+    : m_bus(std::move(bus))
 {
-    this->m_spi = std::make_unique<spidevpp::Spi>(spi_dev);
-    this->m_spi->setBitsPerWord(8);
-    this->m_spi->setSpeed(spi_speed);
-
-    pinMode(this->m_cs, OUTPUT);
-    pinMode(this->m_dc, OUTPUT);
-    if (m_rst != -1)
-    {
-        pinMode(m_rst, OUTPUT);
-        pullUpDnControl(m_rst, PUD_UP);
-    }
+    this->m_bus->setSpeed(spi_speed);
+    this->m_transfers = std::make_unique<SpiTransferQueue>([this](const SpiSegment &segment) {
+        this->sendSegment(segment);
+    });
 }
 
 void Display::sendCommand(uint8_t *argBuffer, int bufferLen, uint8_t cmd)
 {
-    digitalWrite(this->m_dc, LOW);
-    this->setChipSelect(true);
-    this->m_spi->write(&cmd, 1);
-    this->setChipSelect(false);
+    this->m_transfers->waitIdle();
+    this->writeCommandByte(cmd);
     if (bufferLen > 0)
     {
-        this->sendData(argBuffer, bufferLen);
+        this->writeData(argBuffer, bufferLen);
     }
 }
 
@@ -69,33 +55,142 @@ void Display::sendCommand(uint8_t byte, uint8_t arg1, uint8_t arg2, uint8_t arg3
 
 void Display::setChipSelect(bool asserted)
 {
-    if (asserted)
-        digitalWrite(this->m_cs, LOW);
-    else
-        digitalWrite(this->m_cs, HIGH);
+    this->m_bus->setChipSelect(asserted);
 }
 
+/*
+ * The send functions are synchronous, so they first let anything queued
+ * for the I/O thread finish to keep everything on the wire in order.
+ */
 void Display::sendData(uint8_t *buffer, int bufferLen)
 {
-    digitalWrite(this->m_dc, HIGH);
+    this->m_transfers->waitIdle();
+    this->writeData(buffer, bufferLen);
+}
+
+void Display::sendBulkData(uint8_t *buffer, size_t bufferLen)
+{
+    this->m_transfers->waitIdle();
+    this->writeBulkData(buffer, bufferLen);
+}
+
+void Display::sendBatch(const SpiBatch &batch)
+{
+    this->m_transfers->waitIdle();
+    for (const SpiSegment &segment : batch.segments())
+        this->sendSegment(segment);
+}
+
+TransferToken Display::submit(SpiBatch batch)
+{
+    return this->m_transfers->submit(std::move(batch));
+}
+
+void Display::waitForTransfer(TransferToken token)
+{
+    this->m_transfers->wait(token);
+}
+
+TransferToken Display::drawImageAsync(libcamera::Span<uint8_t>& data)
+{
+    this->drawImage(data);
+    return 0;
+}
+
+void Display::sendSegment(const SpiSegment &segment)
+{
+    if (segment.command)
+    {
+        this->writeCommandByte(segment.bytes[0]);
+    }
+    else if (segment.data)
+    {
+        this->writeBulkData(segment.data, segment.length);
+    }
+    else
+    {
+        this->writeData(segment.bytes, segment.length);
+    }
+}
+
+void Display::writeCommandByte(uint8_t cmd)
+{
+    this->m_bus->setDataMode(false);
     this->setChipSelect(true);
-    this->m_spi->write(buffer, bufferLen);
+    this->m_bus->write(&cmd, 1);
     this->setChipSelect(false);
 }
 
-void Display::reset()
+void Display::writeData(const uint8_t *buffer, size_t bufferLen)
+{
+    this->m_bus->setDataMode(true);
+    this->setChipSelect(true);
+    this->m_bus->write(buffer, bufferLen);
+    this->setChipSelect(false);
+}
+
+// Sends a large buffer, like a whole frame, with CS and DC held for the duration
+void Display::writeBulkData(const uint8_t *buffer, size_t bufferLen)
+{
+    this->m_bus->setDataMode(true);
+    this->setChipSelect(true);
+    this->m_bus->writeBulk(buffer, bufferLen);
+    this->setChipSelect(false);
+}
+
+void Display::setDeltaMode(bool enabled)
 {
-    if (this->m_rst != -1)
+    this->m_delta_mode = enabled;
+    this->invalidateFrame();
+}
+
+bool Display::setRgb565(bool enabled)
+{
+    return !enabled;
+}
+
+uint8_t Display::bytesPerPixel() const
+{
+    return this->m_bytes_per_pixel;
+}
+
+void Display::invalidateFrame()
+{
+    if (this->m_dirty_tiles)
+        this->m_dirty_tiles->invalidate();
+}
+
+/*
+ * In delta mode, sends just the changed areas of the frame and returns
+ * true. Returns false when the caller should send the whole frame: delta
+ * mode is off, there's no previous frame, or most of it changed anyway.
+ */
+bool Display::drawChangedTiles(libcamera::Span<uint8_t>& data, uint16_t width, uint16_t height, uint8_t bytesPerPixel)
+{
+    if (!this->m_delta_mode)
+        return false;
+    if (!this->m_dirty_tiles || !this->m_dirty_tiles->matches(width, height, bytesPerPixel))
+        this->m_dirty_tiles = std::make_unique<DirtyTiles>(width, height, bytesPerPixel);
+    if (!this->m_dirty_tiles->update(data))
+        return false;
+
+    for (const DirtyRect &rect : this->m_dirty_tiles->rects())
     {
-        digitalWrite(this->m_rst, LOW);
-        delay(50);
-        digitalWrite(this->m_rst, HIGH);
-        delay(50);
+        this->setAddrWindow(rect.x, rect.y, rect.w, rect.h);
+        libcamera::Span<uint8_t> pixels = this->m_dirty_tiles->rectData(data, rect);
+        this->sendBulkData(pixels.data(), pixels.size());
     }
+    return true;
+}
+
+void Display::reset()
+{
+    this->m_bus->reset();
 }
 
 Display::~Display()
 {
-    this->m_spi.reset();
+    this->m_transfers.reset();
+    this->m_bus.reset();
 }
 
@@ -1,21 +1,57 @@
+#pragma once
+
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <libcamera/libcamera.h>
-#include <spidevpp/spi.h>
+#include "dirty_tiles.hpp"
+#include "display_bus.hpp"
+#include "spi_transfer_queue.hpp"
+
+// Writes colour (0xRRGGBB) as one pixel of 3 bytes (18 bit mode) or 2 bytes (RGB565 mode)
+inline void colour_to_pixel(uint32_t colour, uint8_t *pixel, uint8_t bytesPerPixel)
+{
+    uint8_t red = (colour >> 16) & 0xFF, green = (colour >> 8) & 0xFF, blue = colour & 0xFF;
+    if (bytesPerPixel == 2)
+    {
+        pixel[0] = (red & 0xF8) | (green >> 5);
+        pixel[1] = ((green & 0x1C) << 3) | (blue >> 3);
+    }
+    else
+    {
+        pixel[0] = red;
+        pixel[1] = green;
+        pixel[2] = blue;
+    }
+}
 
 class Display {
     protected:
-        int m_cs;
-        int m_dc;
-        int m_rst;
-        std::unique_ptr<spidevpp::Spi> m_spi;
+        std::unique_ptr<DisplayBus> m_bus;
+        bool m_delta_mode = false;
+        uint8_t m_bytes_per_pixel = 3;
+        std::unique_ptr<DirtyTiles> m_dirty_tiles;
+        std::unique_ptr<SpiTransferQueue> m_transfers;
     public:
-        Display(const char *spi_dev, int spi_speed, int cs, int dc, int rst = -1);
+        // Drives the panel through bus, a SpidevBus or a RecordingBus, at spi_speed
+        Display(std::unique_ptr<DisplayBus> bus, int spi_speed);
         virtual void drawImage(libcamera::Span<uint8_t>& data) = 0;
+        /*
+         * Queues the frame to be sent from the I/O thread and returns
+         * straight away. data must stay untouched until the token has
+         * completed. Panels without an async path draw synchronously.
+         */
+        virtual TransferToken drawImageAsync(libcamera::Span<uint8_t>& data);
+        void waitForTransfer(TransferToken token);
         virtual void drawPixel(int16_t x, int16_t y, uint32_t color) = 0;
         virtual void fillWithColour(uint32_t colour) = 0;
         virtual void displayOff() = 0;
-        ~Display();
+        // Only send the parts of each frame that changed since the last one
+        void setDeltaMode(bool enabled);
+        // Switch the panel to 16 bit RGB565 pixels, false if it can't
+        virtual bool setRgb565(bool enabled);
+        uint8_t bytesPerPixel() const;
+        virtual ~Display();
     protected:
         void sendCommand(uint8_t *buffer, int bufferLen, uint8_t cmd);
         void sendCommand(uint8_t byte);
@@ -25,7 +61,17 @@ class Display {
         void sendCommand(uint8_t byte, uint8_t arg1, uint8_t arg2, uint8_t arg3, uint8_t arg4);
         void sendCommand(uint8_t byte, uint8_t arg1, uint8_t arg2, uint8_t arg3, uint8_t arg4, uint8_t arg5);
         void sendData(uint8_t *buffer, int bufferLen);
+        void sendBulkData(uint8_t *buffer, size_t bufferLen);
         void setChipSelect(bool asserted);
+        TransferToken submit(SpiBatch batch);
+        void sendBatch(const SpiBatch &batch);
+        bool drawChangedTiles(libcamera::Span<uint8_t>& data, uint16_t width, uint16_t height, uint8_t bytesPerPixel);
+        void invalidateFrame();
         virtual void setAddrWindow(uint16_t x1, uint16_t y1, uint16_t w, uint16_t h) = 0;
         void reset();
+    private:
+        void sendSegment(const SpiSegment &segment);
+        void writeCommandByte(uint8_t cmd);
+        void writeData(const uint8_t *buffer, size_t bufferLen);
+        void writeBulkData(const uint8_t *buffer, size_t bufferLen);
 };
@@ -0,0 +1,95 @@
+#include "display_bus.hpp"
+
+BusStats &BusStats::operator+=(const BusStats &other)
+{
+    commands += other.commands;
+    data_bytes += other.data_bytes;
+    cs_toggles += other.cs_toggles;
+    dc_toggles += other.dc_toggles;
+    syscalls += other.syscalls;
+    transfer_ns += other.transfer_ns;
+    return *this;
+}
+
+RecordingBus::RecordingBus(unsigned int bitsPerClock, size_t messageSize, bool loopback)
+    : m_bits_per_clock(bitsPerClock), m_message_size(messageSize), m_loopback(loopback)
+{
+}
+
+void RecordingBus::setSpeed(uint32_t hz)
+{
+    std::lock_guard lock(m_lock);
+    m_speed = hz;
+}
+
+void RecordingBus::setChipSelect(bool asserted)
+{
+    std::lock_guard lock(m_lock);
+    if (asserted != m_selected)
+        m_frame.cs_toggles++;
+    m_selected = asserted;
+}
+
+void RecordingBus::setDataMode(bool data)
+{
+    std::lock_guard lock(m_lock);
+    if (data != m_data_mode)
+        m_frame.dc_toggles++;
+    m_data_mode = data;
+}
+
+void RecordingBus::reset()
+{
+}
+
+void RecordingBus::delay(unsigned int)
+{
+}
+
+void RecordingBus::write(const uint8_t *data, size_t length)
+{
+    record(data, length, m_message_size ? 1 : 0);
+}
+
+void RecordingBus::writeBulk(const uint8_t *data, size_t length)
+{
+    record(data, length, m_message_size ? (length + m_message_size - 1) / m_message_size : 0);
+}
+
+void RecordingBus::record(const uint8_t *data, size_t length, uint64_t syscalls)
+{
+    std::lock_guard lock(m_lock);
+    if (m_data_mode)
+    {
+        m_frame.data_bytes += length;
+        if (m_loopback)
+            m_received.insert(m_received.end(), data, data + length);
+    }
+    else
+    {
+        m_frame.commands += length;
+    }
+    m_frame.syscalls += syscalls;
+    if (m_speed)
+        m_frame.transfer_ns += (length * 8 / m_bits_per_clock) * 1000000000ull / m_speed;
+}
+
+RecordedFrame RecordingBus::endFrame()
+{
+    std::lock_guard lock(m_lock);
+    RecordedFrame frame;
+    frame.stats = m_frame;
+    frame.data = std::move(m_received);
+    m_total += m_frame;
+    m_frame = BusStats();
+    m_received.clear();
+    return frame;
+}
+
+BusStats RecordingBus::totals() const
+{
+    std::lock_guard lock(m_lock);
+    BusStats totals = m_total;
+    totals += m_frame;
+    return totals;
+}
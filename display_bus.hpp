@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// spidev's default bufsiz, the most one SPI_IOC_MESSAGE may carry
+#define SPIDEV_DEFAULT_BUFSIZ 4096
+
+/*
+ * The wires between a display driver and its panel: chip select, the
+ * data/command line, reset and the bytes themselves. The panel drivers
+ * only talk to the panel through this and never touch GPIO themselves,
+ * so they build and run without wiringPi when pointed at a RecordingBus
+ * instead of SpidevBus or ParallelDisplayBus.
+ */
+class DisplayBus {
+    public:
+        virtual ~DisplayBus() = default;
+        // Bit clock in Hz, the panel drivers set their own
+        virtual void setSpeed(uint32_t hz) = 0;
+        virtual void setChipSelect(bool asserted) = 0;
+        // DC (RS on the TP28017) high for data, low for commands
+        virtual void setDataMode(bool data) = 0;
+        // Pulses the reset line, if there is one
+        virtual void reset() = 0;
+        virtual void delay(unsigned int ms) = 0;
+        // A short write such as a command or its arguments
+        virtual void write(const uint8_t *data, size_t length) = 0;
+        // A frame or tile, in as few syscalls as the bus allows
+        virtual void writeBulk(const uint8_t *data, size_t length) = 0;
+};
+
+// What went over a RecordingBus
+struct BusStats
+{
+    uint64_t commands = 0;   // bytes written with DC low
+    uint64_t data_bytes = 0; // bytes written with DC high
+    uint64_t cs_toggles = 0;
+    uint64_t dc_toggles = 0;
+    uint64_t syscalls = 0;
+    // time on the wire at the configured speed, ignoring gaps between transfers
+    uint64_t transfer_ns = 0;
+
+    BusStats &operator+=(const BusStats &other);
+};
+
+struct RecordedFrame
+{
+    BusStats stats;
+    // every data byte, in order, when the bus loops back
+    std::vector<uint8_t> data;
+};
+
+/*
+ * Stands in for the hardware on any Linux box. Nothing is sent anywhere:
+ * each call is counted as it would cost on the real bus, one syscall per
+ * write and one per messageSize bytes of a bulk write like SpidevBus (0
+ * for memory mapped buses that make none), and delays return at once.
+ * With loopback on, the data bytes are kept so the pixels that reached
+ * the panel can be checked. endFrame() draws a line under each frame.
+ */
+class RecordingBus : public DisplayBus {
+    unsigned int m_bits_per_clock;
+    size_t m_message_size;
+    bool m_loopback;
+    uint32_t m_speed = 0;
+    bool m_selected = false;
+    bool m_data_mode = false;
+    BusStats m_frame;
+    BusStats m_total;
+    std::vector<uint8_t> m_received;
+    mutable std::mutex m_lock;
+
+    public:
+        // bitsPerClock is 1 for SPI, 8 for the TP28017's parallel bus
+        RecordingBus(unsigned int bitsPerClock = 1, size_t messageSize = SPIDEV_DEFAULT_BUFSIZ, bool loopback = false);
+        void setSpeed(uint32_t hz) override;
+        void setChipSelect(bool asserted) override;
+        void setDataMode(bool data) override;
+        void reset() override;
+        void delay(unsigned int ms) override;
+        void write(const uint8_t *data, size_t length) override;
+        void writeBulk(const uint8_t *data, size_t length) override;
+
+        // What was sent since the last call, which then starts the next frame
+        RecordedFrame endFrame();
+        // Everything since the bus was created, including the current frame
+        BusStats totals() const;
+
+    private:
+        void record(const uint8_t *data, size_t length, uint64_t syscalls);
+};
@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ili9341.hpp"
+#include "ssd1351.hpp"
+#include "tp28017.hpp"
+
+// Matches dirty_tiles.cpp, a one pixel change should cost one tile
+#define TILE_SIZE 16
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAIL " << what << std::endl;
+        failures++;
+    }
+}
+
+static void check_equal(uint64_t actual, uint64_t expected, const std::string &what)
+{
+    if (actual != expected)
+        std::cerr << what << ": got " << actual << " expected " << expected << std::endl;
+    check(actual == expected, what);
+}
+
+/*
+ * A RecordingBus that also plays the panel: it follows the column, row
+ * and memory write commands and puts the pixel bytes that follow into a
+ * frame of its own, so a test can compare what the panel would show with
+ * what was drawn, whichever way the driver split it up.
+ */
+class PanelModel : public RecordingBus {
+    uint8_t m_column_command, m_row_command, m_write_command;
+    // -1 when the panel's depth isn't set by command
+    int m_pixel_format_command;
+    // bytes per window coordinate, 2 on the ILI9341 and TP28017, 1 on the SSD1351
+    unsigned int m_coordinate_bytes;
+    uint16_t m_width, m_height;
+    bool m_data_mode = false;
+    uint8_t m_command = 0;
+    std::vector<uint8_t> m_args;
+    uint16_t m_x1 = 0, m_x2 = 0, m_y1 = 0, m_y2 = 0;
+    size_t m_cursor = 0;
+
+    public:
+        // as set by the last pixel format command, the panel doesn't ask the driver
+        unsigned int bytesPerPixel = 3;
+        std::vector<uint8_t> frame;
+
+        PanelModel(unsigned int bitsPerClock, size_t messageSize, uint16_t width, uint16_t height,
+                   uint8_t columnCommand, uint8_t rowCommand, uint8_t writeCommand, unsigned int coordinateBytes,
+                   int pixelFormatCommand = -1)
+            : RecordingBus(bitsPerClock, messageSize),
+              m_column_command(columnCommand), m_row_command(rowCommand), m_write_command(writeCommand),
+              m_pixel_format_command(pixelFormatCommand),
+              m_coordinate_bytes(coordinateBytes), m_width(width), m_height(height),
+              frame(width * height * 3)
+        {
+        }
+
+        void setDataMode(bool data) override
+        {
+            RecordingBus::setDataMode(data);
+            m_data_mode = data;
+        }
+
+        void write(const uint8_t *data, size_t length) override
+        {
+            RecordingBus::write(data, length);
+            receive(data, length);
+        }
+
+        void writeBulk(const uint8_t *data, size_t length) override
+        {
+            RecordingBus::writeBulk(data, length);
+            receive(data, length);
+        }
+
+    private:
+        void receive(const uint8_t *data, size_t length)
+        {
+            if (!m_data_mode)
+            {
+                for (size_t i = 0; i < length; i++)
+                {
+                    m_command = data[i];
+                    m_args.clear();
+                    m_cursor = 0;
+                }
+                return;
+            }
+            for (size_t i = 0; i < length; i++)
+            {
+                if (m_command == m_write_command)
+                    storePixelByte(data[i]);
+                else if (m_command == m_column_command || m_command == m_row_command)
+                    storeArg(data[i]);
+                else if (m_command == m_pixel_format_command)
+                    bytesPerPixel = data[i] == 0x55 ? 2 : 3;
+            }
+        }
+
+        void storeArg(uint8_t value)
+        {
+            m_args.push_back(value);
+            if (m_args.size() != m_coordinate_bytes * 2)
+                return;
+            uint16_t start = m_coordinate_bytes == 2 ? (m_args[0] << 8 | m_args[1]) : m_args[0];
+            uint16_t end = m_coordinate_bytes == 2 ? (m_args[2] << 8 | m_args[3]) : m_args[1];
+            if (m_command == m_column_command)
+            {
+                m_x1 = start;
+                m_x2 = end;
+            }
+            else
+            {
+                m_y1 = start;
+                m_y2 = end;
+            }
+        }
+
+        // Fills the window row by row, as the controllers do after a memory write
+        void storePixelByte(uint8_t value)
+        {
+            size_t rowBytes = (m_x2 - m_x1 + 1) * bytesPerPixel;
+            size_t x = m_x1 * bytesPerPixel + m_cursor % rowBytes;
+            size_t y = m_y1 + m_cursor / rowBytes;
+            m_cursor++;
+            if (y <= m_y2 && y < m_height && x < m_width * bytesPerPixel)
+                frame[y * m_width * bytesPerPixel + x] = value;
+        }
+};
+
+struct Panel
+{
+    std::string name;
+    uint16_t width;
+    uint16_t height;
+    std::unique_ptr<Display> display;
+    PanelModel *bus;
+    // What a repeat of the same full frame should cost, once the window is set up
+    BusStats steady;
+};
+
+static std::vector<uint8_t> test_frame(size_t length, uint32_t seed)
+{
+    std::vector<uint8_t> data(length);
+    uint32_t state = seed | 1;
+    for (auto &byte : data)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        byte = (uint8_t)state;
+    }
+    return data;
+}
+
+static RecordedFrame draw(Panel &panel, std::vector<uint8_t> &frame)
+{
+    libcamera::Span<uint8_t> data(frame.data(), frame.size());
+    panel.display->drawImage(data);
+    return panel.bus->endFrame();
+}
+
+static bool panel_shows(const Panel &panel, const std::vector<uint8_t> &frame)
+{
+    return std::equal(frame.begin(), frame.end(), panel.bus->frame.begin());
+}
+
+// The per-frame counters of a full frame, then of the same frame again
+static void check_full_frames(Panel &panel)
+{
+    const std::string name = panel.name + " " + std::to_string(panel.display->bytesPerPixel() * 8) + " bit";
+    const size_t frameBytes = panel.width * panel.height * panel.display->bytesPerPixel();
+    std::vector<uint8_t> frame = test_frame(frameBytes, frameBytes);
+
+    BusStats first = draw(panel, frame).stats;
+    check(panel_shows(panel, frame), name + ": first frame reaches the panel");
+    check(first.data_bytes >= frameBytes, name + ": first frame sends every pixel");
+
+    frame = test_frame(frameBytes, frameBytes + 1);
+    BusStats repeat = draw(panel, frame).stats;
+    check(panel_shows(panel, frame), name + ": second frame reaches the panel");
+    check_equal(repeat.commands, panel.steady.commands, name + " command bytes per frame");
+    check_equal(repeat.data_bytes, panel.steady.data_bytes, name + " data bytes per frame");
+    check_equal(repeat.cs_toggles, panel.steady.cs_toggles, name + " CS toggles per frame");
+    check_equal(repeat.dc_toggles, panel.steady.dc_toggles, name + " DC toggles per frame");
+    check_equal(repeat.syscalls, panel.steady.syscalls, name + " syscalls per frame");
+    std::cout << name << ": " << repeat.data_bytes << " data bytes, " << repeat.commands << " commands, "
+              << repeat.cs_toggles << " CS and " << repeat.dc_toggles << " DC toggles, "
+              << repeat.syscalls << " syscalls, " << repeat.transfer_ns / 1000 << "us on the wire" << std::endl;
+}
+
+// In delta mode an unchanged frame costs nothing and one changed pixel one tile
+static void check_delta_frames(Panel &panel)
+{
+    const std::string name = panel.name + " delta";
+    const size_t frameBytes = panel.width * panel.height * panel.display->bytesPerPixel();
+    std::vector<uint8_t> frame = test_frame(frameBytes, 99);
+    panel.display->setDeltaMode(true);
+
+    draw(panel, frame);
+    check(panel_shows(panel, frame), name + ": first frame reaches the panel");
+
+    BusStats unchanged = draw(panel, frame).stats;
+    check_equal(unchanged.data_bytes + unchanged.commands + unchanged.syscalls, 0, name + " unchanged frame bytes");
+
+    frame[0] ^= 0xFF;
+    BusStats onePixel = draw(panel, frame).stats;
+    const size_t tileBytes = TILE_SIZE * TILE_SIZE * panel.display->bytesPerPixel();
+    check(panel_shows(panel, frame), name + ": changed pixel reaches the panel");
+    check(onePixel.data_bytes >= tileBytes && onePixel.data_bytes <= tileBytes + 8,
+          name + ": one changed pixel sends one tile, sent " + std::to_string(onePixel.data_bytes));
+    panel.display->setDeltaMode(false);
+}
+
+static void check_panel(Panel &panel)
+{
+    panel.bus->endFrame();
+    check_equal(panel.bus->bytesPerPixel, panel.display->bytesPerPixel(), panel.name + " panel and driver depth");
+    check_full_frames(panel);
+    check_delta_frames(panel);
+}
+
+static bool pixel_is(const Panel &panel, int x, int y, uint32_t colour)
+{
+    const unsigned int bytesPerPixel = panel.bus->bytesPerPixel;
+    uint8_t expected[3];
+    colour_to_pixel(colour, expected, bytesPerPixel);
+    return std::equal(expected, expected + bytesPerPixel,
+                      panel.bus->frame.begin() + ((size_t)y * panel.width + x) * bytesPerPixel);
+}
+
+// A fill straight after init, as camera.cpp does, must be in the depth init gave the panel
+static void check_fill(Panel &panel)
+{
+    const uint32_t colour = 0xff0000;
+    panel.display->fillWithColour(colour);
+    panel.bus->endFrame();
+    bool filled = true;
+    for (int y = 0; y < panel.height && filled; y++)
+        for (int x = 0; x < panel.width && filled; x++)
+            filled = pixel_is(panel, x, y, colour);
+    check(filled, panel.name + ": fill after init matches the panel's depth");
+}
+
+// drawPixel writes one pixel at whatever depth the panel is in
+static void check_draw_pixel(Panel &panel)
+{
+    const uint32_t colour = 0x3C82E7;
+    panel.display->drawPixel(5, 3, colour);
+    panel.bus->endFrame();
+    check(pixel_is(panel, 5, 3, colour),
+          panel.name + ": drawPixel at " + std::to_string(panel.bus->bytesPerPixel * 8) + " bit");
+}
+
+static void check_ili9341()
+{
+    auto bus = std::make_unique<PanelModel>(1, SPIDEV_DEFAULT_BUFSIZ, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT,
+                                            ILI9341_CASET, ILI9341_PASET, ILI9341_RAMWR, 2, ILI9341_PIXFMT);
+    Panel panel = {"ILI9341", ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT, nullptr, bus.get(), {}};
+    panel.display = std::make_unique<ILI9341>(std::move(bus));
+    check_fill(panel);
+
+    for (bool rgb565 : {false, true})
+    {
+        panel.display->setRgb565(rgb565);
+        check_draw_pixel(panel);
+        // one window, RAMWR then the frame with CS and DC held
+        const uint64_t frameBytes = ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT * panel.bus->bytesPerPixel;
+        panel.steady.commands = 1;
+        panel.steady.data_bytes = frameBytes;
+        panel.steady.cs_toggles = 4;
+        panel.steady.dc_toggles = 2;
+        panel.steady.syscalls = 1 + (frameBytes + SPIDEV_DEFAULT_BUFSIZ - 1) / SPIDEV_DEFAULT_BUFSIZ;
+        check_panel(panel);
+    }
+}
+
+static void check_ssd1351()
+{
+    auto bus = std::make_unique<PanelModel>(1, SPIDEV_DEFAULT_BUFSIZ, SSD1351WIDTH, SSD1351HEIGHT,
+                                            SSD1351_CMD_SETCOLUMN, SSD1351_CMD_SETROW, SSD1351_CMD_WRITERAM, 1);
+    Panel panel = {"SSD1351", SSD1351WIDTH, SSD1351HEIGHT, nullptr, bus.get(), {}};
+    panel.display = std::make_unique<Ssd1351>(std::move(bus));
+    panel.bus->bytesPerPixel = panel.display->bytesPerPixel();
+
+    // 8 row strips, each a column, a row and a write command then its pixels
+    const uint64_t strips = SSD1351HEIGHT / 8;
+    panel.steady.commands = strips * 3;
+    panel.steady.data_bytes = strips * 4 + SSD1351WIDTH * SSD1351HEIGHT * panel.bus->bytesPerPixel;
+    panel.steady.cs_toggles = strips * 6 * 2;
+    panel.steady.dc_toggles = strips * 6;
+    panel.steady.syscalls = strips * 6;
+    check_panel(panel);
+}
+
+static void check_tp28017()
+{
+    // 8 bits per clock and no syscalls, the bytes go out with GPIO stores
+    auto bus = std::make_unique<PanelModel>(8, 0, TP28017_TFTWIDTH, TP28017_TFTHEIGHT,
+                                            TP28017_CASET, TP28017_PASET, TP28017_RAMWR, 2, TP28017_PIXFMT);
+    Panel panel = {"TP28017", TP28017_TFTWIDTH, TP28017_TFTHEIGHT, nullptr, bus.get(), {}};
+    panel.display = std::make_unique<Tp28017>(std::move(bus));
+    check_fill(panel);
+
+    for (bool rgb565 : {false, true})
+    {
+        panel.display->setRgb565(rgb565);
+        check_draw_pixel(panel);
+        // 8 row strips of the full width, so only the rows move between them
+        const uint64_t strips = TP28017_TFTHEIGHT / 8;
+        panel.steady.commands = strips * 2;
+        panel.steady.data_bytes = strips * 4 + TP28017_TFTWIDTH * TP28017_TFTHEIGHT * panel.bus->bytesPerPixel;
+        panel.steady.cs_toggles = strips * 4 * 2;
+        panel.steady.dc_toggles = strips * 4;
+        panel.steady.syscalls = 0;
+        check_panel(panel);
+    }
+}
+
+int main()
+{
+    check_ili9341();
+    check_ssd1351();
+    check_tp28017();
+
+    std::cout << (failures ? "FAIL" : "ok") << " display drivers on RecordingBus" << std::endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
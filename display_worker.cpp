@@ -0,0 +1,117 @@
+#include <algorithm>
+#include "display_worker.hpp"
+#include "metrics.hpp"
+
+DisplayWorker::DisplayWorker(DrawFunction draw)
+    : DisplayWorker([draw = std::move(draw)](libcamera::Span<uint8_t> &data) -> TransferToken {
+          draw(data);
+          return 0;
+      },
+      [](TransferToken) {})
+{
+}
+
+DisplayWorker::DisplayWorker(AsyncDrawFunction draw, WaitFunction wait)
+    : m_draw(std::move(draw)), m_wait(std::move(wait))
+{
+    std::fill(std::begin(m_frames), std::end(m_frames), TRACE_NO_FRAME);
+    m_thread = std::thread(&DisplayWorker::run, this);
+}
+
+DisplayWorker::~DisplayWorker()
+{
+    {
+        std::unique_lock lock(m_lock);
+        m_stopping = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+libcamera::Span<uint8_t> DisplayWorker::backBuffer(size_t length)
+{
+    // only the camera side touches the back buffer, so no lock needed
+    std::vector<uint8_t> &buffer = m_buffers[m_back];
+    if (buffer.size() < length)
+        buffer.resize(length);
+    return libcamera::Span<uint8_t>(buffer.data(), buffer.size());
+}
+
+void DisplayWorker::present(size_t length, uint32_t frame)
+{
+    std::unique_lock lock(m_lock);
+    m_lengths[m_back] = length;
+    m_frames[m_back] = frame;
+    if (m_fresh)
+    {
+        m_dropped++;
+        metrics().display_frames_dropped.add();
+    }
+    std::swap(m_back, m_ready);
+    m_fresh = true;
+
+    lock.unlock();
+    m_cond.notify_one();
+}
+
+uint64_t DisplayWorker::droppedFrames()
+{
+    std::unique_lock lock(m_lock);
+    return m_dropped;
+}
+
+void DisplayWorker::run()
+{
+    std::unique_lock lock(m_lock);
+    while (true)
+    {
+#if FRAME_TRACE
+        // with nothing new to queue, see the last frame onto the panel so
+        // its draw is traced when it finishes rather than when the next arrives
+        if (!m_fresh && !m_stopping && m_in_flight_token)
+        {
+            TransferToken token = m_in_flight_token;
+            lock.unlock();
+            m_wait(token);
+            drawn(m_in_flight);
+            lock.lock();
+            m_in_flight_token = 0;
+            continue;
+        }
+#endif
+        m_cond.wait(lock, [this] { return m_stopping || m_fresh; });
+        if (m_stopping)
+        {
+            m_wait(m_in_flight_token);
+            drawn(m_in_flight);
+            return;
+        }
+
+        std::swap(m_front, m_ready);
+        m_fresh = false;
+        lock.unlock();
+
+        libcamera::Span<uint8_t> data(m_buffers[m_front].data(), m_lengths[m_front]);
+        TransferToken token = m_draw(data);
+
+        // the previous frame was queued ahead of this one, once it's done
+        // its buffer can go back into rotation
+        m_wait(m_in_flight_token);
+        drawn(m_in_flight);
+        std::swap(m_front, m_in_flight);
+        m_in_flight_token = token;
+        // a synchronous draw is already on the panel
+        if (token == 0)
+            drawn(m_in_flight);
+
+        lock.lock();
+    }
+}
+
+// Traces the frame in buffer as on the panel, once
+void DisplayWorker::drawn(int buffer)
+{
+    if (m_frames[buffer] != TRACE_NO_FRAME)
+        trace_frame(TraceStage::DrawEnd, m_frames[buffer]);
+    m_frames[buffer] = TRACE_NO_FRAME;
+}
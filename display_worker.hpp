@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <libcamera/base/span.h>
+#include "frame_trace.hpp"
+#include "spi_transfer_queue.hpp"
+
+#define DISPLAY_WORKER_BUFFERS 4
+
+/*
+ * Pushes viewfinder frames to the display on its own thread, so a slow
+ * bus never holds up the camera. Three buffers rotate between the camera
+ * side (being converted into), the handoff slot (newest complete frame)
+ * and the display side (being sent). present() replaces whatever is in
+ * the handoff slot, so the display always shows the newest frame and
+ * stale ones are dropped rather than queued.
+ *
+ * With an async draw function the frame just handed to the bus is parked
+ * in a fourth, in-flight slot until its transfer completes, so the next
+ * frame can be queued behind it without ever recycling a buffer that is
+ * still being sent.
+ */
+class DisplayWorker {
+    public:
+        using DrawFunction = std::function<void(libcamera::Span<uint8_t> &)>;
+        using AsyncDrawFunction = std::function<TransferToken(libcamera::Span<uint8_t> &)>;
+        using WaitFunction = std::function<void(TransferToken)>;
+
+    private:
+        AsyncDrawFunction m_draw;
+        WaitFunction m_wait;
+        std::vector<uint8_t> m_buffers[DISPLAY_WORKER_BUFFERS];
+        size_t m_lengths[DISPLAY_WORKER_BUFFERS] = {};
+        // frame sequence numbers, for tracing when each reached the panel
+        uint32_t m_frames[DISPLAY_WORKER_BUFFERS];
+        int m_back = 0;
+        int m_ready = 1;
+        int m_front = 2;
+        int m_in_flight = 3;
+        TransferToken m_in_flight_token = 0;
+        bool m_fresh = false;
+        bool m_stopping = false;
+        uint64_t m_dropped = 0;
+        std::mutex m_lock;
+        std::condition_variable m_cond;
+        std::thread m_thread;
+
+    public:
+        DisplayWorker(DrawFunction draw);
+        DisplayWorker(AsyncDrawFunction draw, WaitFunction wait);
+        ~DisplayWorker();
+
+        // The buffer to convert the next frame into, grown to at least length bytes
+        libcamera::Span<uint8_t> backBuffer(size_t length);
+        // Hands the first length bytes of the back buffer over to be drawn
+        void present(size_t length, uint32_t frame = TRACE_NO_FRAME);
+        uint64_t droppedFrames();
+
+    private:
+        void run();
+        void drawn(int buffer);
+};
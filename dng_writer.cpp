@@ -0,0 +1,213 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+#include "dng_writer.hpp"
+
+#define DNG_CAMERA_MODEL "astro-pi"
+
+#define TIFF_BYTE 1
+#define TIFF_ASCII 2
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+#define TIFF_RATIONAL 5
+#define TIFF_SRATIONAL 10
+
+struct TiffEntry
+{
+    uint16_t tag;
+    uint16_t type;
+    uint32_t count;
+    std::vector<uint8_t> value;
+};
+
+class TiffIfd
+{
+    std::vector<TiffEntry> m_entries;
+
+    void add(uint16_t tag, uint16_t type, uint32_t count, const void *data, size_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        m_entries.push_back({tag, type, count, std::vector<uint8_t>(bytes, bytes + size)});
+    }
+
+public:
+    void bytes(uint16_t tag, std::vector<uint8_t> values)
+    {
+        add(tag, TIFF_BYTE, values.size(), values.data(), values.size());
+    }
+    void ascii(uint16_t tag, const char *value)
+    {
+        add(tag, TIFF_ASCII, strlen(value) + 1, value, strlen(value) + 1);
+    }
+    void shorts(uint16_t tag, std::vector<uint16_t> values)
+    {
+        add(tag, TIFF_SHORT, values.size(), values.data(), values.size() * 2);
+    }
+    void longs(uint16_t tag, std::vector<uint32_t> values)
+    {
+        add(tag, TIFF_LONG, values.size(), values.data(), values.size() * 4);
+    }
+    // numerator/denominator pairs
+    void rationals(uint16_t tag, uint16_t type, std::vector<int32_t> values)
+    {
+        add(tag, type, values.size() / 2, values.data(), values.size() * 4);
+    }
+    void setLong(uint16_t tag, uint32_t value)
+    {
+        for (auto &entry : m_entries)
+            if (entry.tag == tag)
+                memcpy(entry.value.data(), &value, 4);
+    }
+
+    // Size of the IFD and its out of line values when written after the header
+    size_t size() const
+    {
+        size_t size = 2 + m_entries.size() * 12 + 4;
+        for (auto &entry : m_entries)
+            if (entry.value.size() > 4)
+                size += (entry.value.size() + 1) & ~1;
+        return size;
+    }
+
+    // Appends the IFD, which starts at out.size(), followed by its long values
+    void write(std::vector<uint8_t> &out) const
+    {
+        auto append = [&out](const void *data, size_t size) {
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            out.insert(out.end(), bytes, bytes + size);
+        };
+
+        uint32_t extra = out.size() + 2 + m_entries.size() * 12 + 4;
+        uint16_t count = m_entries.size();
+        append(&count, 2);
+        for (auto &entry : m_entries)
+        {
+            append(&entry.tag, 2);
+            append(&entry.type, 2);
+            append(&entry.count, 4);
+            uint8_t value[4] = {};
+            if (entry.value.size() > 4)
+            {
+                memcpy(value, &extra, 4);
+                extra += (entry.value.size() + 1) & ~1;
+            }
+            else
+            {
+                memcpy(value, entry.value.data(), entry.value.size());
+            }
+            append(value, 4);
+        }
+        uint32_t next = 0;
+        append(&next, 4);
+        for (auto &entry : m_entries)
+        {
+            if (entry.value.size() > 4)
+            {
+                append(entry.value.data(), entry.value.size());
+                if (entry.value.size() & 1)
+                    out.push_back(0);
+            }
+        }
+    }
+};
+
+// 0 = red, 1 = green, 2 = blue, in reading order of the 2x2 tile
+static std::vector<uint8_t> cfa_pattern(PixelColourFormat format)
+{
+    switch (format)
+    {
+        case PixelColourFormat::SGRBG12: return {1, 0, 2, 1};
+        case PixelColourFormat::SGBRG12: return {1, 2, 0, 1};
+        case PixelColourFormat::SBGGR12: return {2, 1, 1, 0};
+        default: return {0, 1, 1, 2};
+    }
+}
+
+bool write_dng(const std::string &filename, libcamera::Span<const uint8_t> data,
+               unsigned int width, unsigned int height, unsigned int stride,
+               PixelColourFormat format)
+{
+    size_t length = (size_t)stride * height;
+    if (data.size() < length)
+    {
+        std::cerr << "Raw plane of " << data.size() << " bytes is too small for "
+                  << width << "x" << height << " stride " << stride << std::endl;
+        return false;
+    }
+
+    // Entries must be in ascending tag order
+    TiffIfd ifd;
+    ifd.longs(254, {0});                            // NewSubfileType
+    ifd.longs(256, {stride / 2});                   // ImageWidth, including padding
+    ifd.longs(257, {height});                       // ImageLength
+    ifd.shorts(258, {16});                          // BitsPerSample
+    ifd.shorts(259, {1});                           // Compression: none
+    ifd.shorts(262, {32803});                       // PhotometricInterpretation: CFA
+    ifd.ascii(271, "Raspberry Pi");                 // Make
+    ifd.ascii(272, DNG_CAMERA_MODEL);               // Model
+    ifd.longs(273, {0});                            // StripOffsets, filled in below
+    ifd.shorts(274, {1});                           // Orientation
+    ifd.shorts(277, {1});                           // SamplesPerPixel
+    ifd.longs(278, {height});                       // RowsPerStrip
+    ifd.longs(279, {(uint32_t)length});             // StripByteCounts
+    ifd.shorts(284, {1});                           // PlanarConfiguration
+    ifd.shorts(33421, {2, 2});                      // CFARepeatPatternDim
+    ifd.bytes(33422, cfa_pattern(format));          // CFAPattern
+    ifd.bytes(50706, {1, 4, 0, 0});                 // DNGVersion
+    ifd.bytes(50707, {1, 1, 0, 0});                 // DNGBackwardVersion
+    ifd.ascii(50708, DNG_CAMERA_MODEL);             // UniqueCameraModel
+    ifd.bytes(50710, {0, 1, 2});                    // CFAPlaneColor
+    ifd.shorts(50711, {1});                         // CFALayout: rectangular
+    ifd.longs(50714, {DNG_BLACK_LEVEL});            // BlackLevel
+    ifd.longs(50717, {DNG_WHITE_LEVEL});            // WhiteLevel
+    ifd.longs(50719, {0, 0});                       // DefaultCropOrigin
+    ifd.longs(50720, {width, height});              // DefaultCropSize
+    // No colour calibration yet, so an identity ColorMatrix1 and neutral white balance
+    ifd.rationals(50721, TIFF_SRATIONAL, {1, 1, 0, 1, 0, 1,
+                                          0, 1, 1, 1, 0, 1,
+                                          0, 1, 0, 1, 1, 1});
+    ifd.rationals(50728, TIFF_RATIONAL, {1, 1, 1, 1, 1, 1}); // AsShotNeutral
+    ifd.shorts(50778, {21});                        // CalibrationIlluminant1: D65
+
+    const size_t headerSize = 8;
+    uint32_t dataOffset = (headerSize + ifd.size() + 15) & ~15;
+    ifd.setLong(273, dataOffset);
+
+    std::vector<uint8_t> header = {'I', 'I', 42, 0, 8, 0, 0, 0};
+    ifd.write(header);
+    header.resize(dataOffset, 0);
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct iovec iov[2] = {
+        {header.data(), header.size()},
+        {const_cast<uint8_t *>(data.data()), length},
+    };
+    size_t total = header.size() + length;
+    ssize_t written = writev(fd, iov, 2);
+    // writev only comes up short on errors or signals, finish off the plane if it does
+    while (written >= (ssize_t)header.size() && (size_t)written < total)
+    {
+        ssize_t ret = write(fd, data.data() + written - header.size(), total - written);
+        if (ret <= 0)
+            break;
+        written += ret;
+    }
+    close(fd);
+
+    if (written < 0 || (size_t)written != total)
+    {
+        std::cerr << "Failed to write " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
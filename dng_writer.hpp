@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <libcamera/base/span.h>
+#include "image.h"
+
+// IMX477 black and white levels in 12 bit units
+#define DNG_BLACK_LEVEL 256
+#define DNG_WHITE_LEVEL 4095
+
+/*
+ * Writes 12 bit Bayer data held in 16 bit little-endian containers (the
+ * unpacked SRGGB12/SGRBG12/SGBRG12/SBGGR12 formats) as an uncompressed DNG.
+ * The plane is written as a single strip directly from `data`, padding and
+ * all, with DefaultCropSize trimming the stride padding back off.
+ */
+bool write_dng(const std::string &filename, libcamera::Span<const uint8_t> data,
+               unsigned int width, unsigned int height, unsigned int stride,
+               PixelColourFormat format);
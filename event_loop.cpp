@@ -14,11 +14,13 @@
 EventLoop *EventLoop::instance_ = nullptr;
 
 EventLoop::EventLoop()
+    : overflowing_(false), wakePending_(false)
 {
     assert(!instance_);
 
     evthread_use_pthreads();
     event_ = event_base_new();
+    wake_ = event_new(event_, -1, 0, &wakeTriggered, this);
     instance_ = this;
 }
 
@@ -26,6 +28,7 @@ EventLoop::~EventLoop()
 {
     instance_ = nullptr;
 
+    event_free(wake_);
     event_base_free(event_);
     libevent_global_shutdown();
 }
@@ -73,28 +76,67 @@ void EventLoop::timeout(unsigned int sec)
     evtimer_add(ev, &tv);
 }
 
-void EventLoop::callLater(const std::function<void()> &func)
+void EventLoop::wakeTriggered(int fd, short event, void *arg)
 {
+    EventLoop *self = static_cast<EventLoop *>(arg);
+    self->dispatchCalls();
+}
+
+void EventLoop::callLater(InlineFunction func)
+{
+    if (overflowing_.load(std::memory_order_acquire) || !calls_.tryPush(func))
     {
+        // keep later calls behind this one until the overflow is drained
         std::unique_lock<std::mutex> locker(lock_);
-        calls_.push_back(func);
+        overflow_.push_back(std::move(func));
+        overflowing_.store(true, std::memory_order_release);
     }
 
-    interrupt();
+    /*
+     * Only the first call since the last drain needs to wake the loop.
+     * Activating an event, unlike breaking out of the loop, isn't lost
+     * if the loop hasn't started waiting yet. The fence orders the push
+     * before the flag is read, pairing with the one in dispatchCalls().
+     */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!wakePending_.exchange(true, std::memory_order_acq_rel))
+        event_active(wake_, 0, 0);
 }
 
 void EventLoop::dispatchCalls()
 {
-    std::unique_lock<std::mutex> locker(lock_);
-
-    for (auto iter = calls_.begin(); iter != calls_.end();)
+    /*
+     * Clear the flag before draining, and fence so the clear can't pass
+     * the loads in tryPop(). Then either the drain sees a call, or the
+     * call's producer sees the flag clear and wakes the loop again.
+     */
+    wakePending_.exchange(false, std::memory_order_acq_rel);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    InlineFunction call;
+    while (true)
     {
-        std::function<void()> call = std::move(*iter);
-
-        iter = calls_.erase(iter);
-
-        locker.unlock();
-        call();
-        locker.lock();
+        while (calls_.tryPop(call))
+        {
+            call();
+            call.reset();
+        }
+
+        if (!overflowing_.load(std::memory_order_acquire))
+            break;
+
+        std::deque<InlineFunction> overflow;
+        {
+            std::unique_lock<std::mutex> locker(lock_);
+            overflow.swap(overflow_);
+            overflowing_.store(false, std::memory_order_release);
+        }
+        for (InlineFunction &pending : overflow)
+            pending();
     }
-}
\ No newline at end of file
+
+    // anything that landed after the last pop gets another pass rather than waiting for an unrelated event
+    if ((!calls_.empty() || overflowing_.load(std::memory_order_acquire)) &&
+        !wakePending_.exchange(true, std::memory_order_acq_rel))
+        event_active(wake_, 0, 0);
+}
@@ -8,10 +8,14 @@
 #define __SIMPLE_CAM_EVENT_LOOP_H__
 
 #include <atomic>
-#include <functional>
-#include <list>
+#include <deque>
 #include <mutex>
 
+#include "call_queue.hpp"
+
+#define EVENT_LOOP_QUEUE_SIZE 256
+
+struct event;
 struct event_base;
 
 class EventLoop
@@ -24,19 +28,30 @@ public:
     int exec();
 
     void timeout(unsigned int sec);
-    void callLater(const std::function<void()> &func);
+    void callLater(InlineFunction func);
 
 private:
     static EventLoop *instance_;
 
     static void timeoutTriggered(int fd, short event, void *arg);
+    static void wakeTriggered(int fd, short event, void *arg);
 
     struct event_base *event_;
+    struct event *wake_;
     std::atomic<bool> exit_;
     int exitCode_;
 
-    std::list<std::function<void()>> calls_;
+    /*
+     * Calls come in from libcamera's completion thread, so they're queued
+     * without taking a lock or allocating. The rare call that finds the
+     * ring full goes on the overflow list instead.
+     */
+    MpscRing<InlineFunction, EVENT_LOOP_QUEUE_SIZE> calls_;
+    std::deque<InlineFunction> overflow_;
+    std::atomic<bool> overflowing_;
     std::mutex lock_;
+    // set from the first queued call until the loop drains them
+    std::atomic<bool> wakePending_;
 
     void interrupt();
     void dispatchCalls();
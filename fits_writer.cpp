@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <errno.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "fits_writer.hpp"
+
+#define FITS_BLOCK_SIZE 2880
+#define FITS_CARD_SIZE 80
+#define FITS_WRITE_BUFFER (1024 * 1024)
+
+class FitsHeader
+{
+    std::string m_cards;
+
+    // Numbers are right aligned to column 30, strings left aligned from column 11
+    void card(const char *keyword, const std::string &value, const char *comment, bool alignLeft = false)
+    {
+        char line[FITS_CARD_SIZE + 1];
+        if (alignLeft)
+            snprintf(line, sizeof(line), "%-8.8s= %-20s", keyword, value.c_str());
+        else
+            snprintf(line, sizeof(line), "%-8.8s= %20s", keyword, value.c_str());
+        std::string text(line);
+        if (comment)
+        {
+            text += " / ";
+            text += comment;
+        }
+        text.resize(FITS_CARD_SIZE, ' ');
+        m_cards += text;
+    }
+
+public:
+    void logical(const char *keyword, bool value, const char *comment = nullptr)
+    {
+        card(keyword, value ? "T" : "F", comment);
+    }
+    void integer(const char *keyword, long long value, const char *comment = nullptr)
+    {
+        card(keyword, std::to_string(value), comment);
+    }
+    void real(const char *keyword, double value, const char *comment = nullptr)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.6G", value);
+        std::string text(buffer);
+        if (text.find_first_of(".E") == std::string::npos)
+            text += ".";
+        card(keyword, text, comment);
+    }
+    void string(const char *keyword, const std::string &value, const char *comment = nullptr)
+    {
+        // at least 8 characters between the quotes
+        std::string quoted = value;
+        quoted.resize(std::max<size_t>(value.size(), 8), ' ');
+        card(keyword, "'" + quoted + "'", comment, true);
+    }
+    // END card and padding to a whole block
+    std::string finish()
+    {
+        std::string end = "END";
+        end.resize(FITS_CARD_SIZE, ' ');
+        m_cards += end;
+        m_cards.resize((m_cards.size() + FITS_BLOCK_SIZE - 1) / FITS_BLOCK_SIZE * FITS_BLOCK_SIZE, ' ');
+        return m_cards;
+    }
+};
+
+// Frame timestamps are CLOCK_MONOTONIC, FITS wants UTC
+static std::string observation_date(uint64_t timestamp_ns)
+{
+    struct timespec now_real, now_monotonic;
+    clock_gettime(CLOCK_REALTIME, &now_real);
+    clock_gettime(CLOCK_MONOTONIC, &now_monotonic);
+    int64_t monotonic_ns = (int64_t)now_monotonic.tv_sec * 1000000000 + now_monotonic.tv_nsec;
+    int64_t real_ns = (int64_t)now_real.tv_sec * 1000000000 + now_real.tv_nsec;
+    if (timestamp_ns)
+        real_ns -= monotonic_ns - (int64_t)timestamp_ns;
+
+    time_t seconds = real_ns / 1000000000;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    char buffer[32];
+    size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(buffer + length, sizeof(buffer) - length, ".%03d", (int)(real_ns / 1000000 % 1000));
+    return buffer;
+}
+
+static const char *bayer_pattern(PixelColourFormat format)
+{
+    switch (format)
+    {
+        case PixelColourFormat::SGRBG12: return "GRBG";
+        case PixelColourFormat::SGBRG12: return "GBRG";
+        case PixelColourFormat::SBGGR12: return "BGGR";
+        default: return "RGGB";
+    }
+}
+
+bool write_fits(const std::string &filename, const Image &image)
+{
+    const bool bayer = image.isBayer();
+    const int width = image.width();
+    const int height = image.height();
+    const unsigned int stride = image.stride();
+    libcamera::Span<const uint8_t> plane = image.data(0);
+    if (plane.size() < (size_t)stride * height)
+    {
+        std::cerr << "Image plane is too small to write " << filename << std::endl;
+        return false;
+    }
+
+    const CaptureInfo &info = image.captureInfo();
+    FitsHeader header;
+    header.logical("SIMPLE", true, "conforms to FITS standard");
+    header.integer("BITPIX", bayer ? 16 : 8, "bits per data value");
+    header.integer("NAXIS", bayer ? 2 : 3, "number of data axes");
+    header.integer("NAXIS1", width, "columns");
+    header.integer("NAXIS2", height, "rows");
+    if (!bayer)
+        header.integer("NAXIS3", 3, "R, G and B planes");
+    if (bayer)
+    {
+        header.integer("BZERO", 32768, "unsigned 16 bit data");
+        header.integer("BSCALE", 1);
+        header.string("BAYERPAT", bayer_pattern(image.format()), "colour filter array");
+        header.integer("XBAYROFF", 0);
+        header.integer("YBAYROFF", 0);
+    }
+    header.string("ROWORDER", "TOP-DOWN");
+    header.string("INSTRUME", "astro-pi");
+    header.string("DATE-OBS", observation_date(info.timestamp_ns), "UTC start of exposure");
+    header.real("EXPTIME", info.exposure_us / 1e6, "exposure time in seconds");
+    header.real("GAIN", info.analogue_gain, "sensor analogue gain");
+    header.integer("FRAMESEQ", info.sequence, "camera frame sequence number");
+    std::string cards = header.finish();
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Failed to open " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    setvbuf(file, nullptr, _IOFBF, FITS_WRITE_BUFFER);
+    fwrite(cards.data(), 1, cards.size(), file);
+
+    // FITS is big-endian and signed, so each row is swizzled through this
+    std::vector<uint8_t> row(bayer ? width * 2 : width);
+    size_t dataSize = 0;
+    if (bayer)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            const uint8_t *src = plane.data() + (size_t)y * stride;
+            for (int x = 0; x < width; x++)
+            {
+                // little-endian unsigned to big-endian offset by BZERO
+                row[x * 2] = src[x * 2 + 1] ^ 0x80;
+                row[x * 2 + 1] = src[x * 2];
+            }
+            fwrite(row.data(), 1, row.size(), file);
+        }
+        dataSize = (size_t)width * height * 2;
+    }
+    else
+    {
+        // planes are stored B, G, R per pixel, FITS wants R, G, B planes
+        for (int channel = 2; channel >= 0; channel--)
+        {
+            for (int y = 0; y < height; y++)
+            {
+                const uint8_t *src = plane.data() + (size_t)y * stride + channel;
+                for (int x = 0; x < width; x++)
+                    row[x] = src[x * 3];
+                fwrite(row.data(), 1, row.size(), file);
+            }
+        }
+        dataSize = (size_t)width * height * 3;
+    }
+
+    std::vector<uint8_t> padding((FITS_BLOCK_SIZE - dataSize % FITS_BLOCK_SIZE) % FITS_BLOCK_SIZE, 0);
+    fwrite(padding.data(), 1, padding.size(), file);
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok)
+        std::cerr << "Failed to write " << filename << ": " << strerror(errno) << std::endl;
+    return ok;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+#include "image.h"
+
+/*
+ * Writes a still as FITS: Bayer images as a single 16 bit plane, RGB
+ * images as three 8 bit planes (R, G, B). Exposure, gain and timestamp
+ * come from the Image's CaptureInfo. The header goes out first and the
+ * pixel data is streamed row by row from the image planes.
+ */
+bool write_fits(const std::string &filename, const Image &image);
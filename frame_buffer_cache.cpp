@@ -0,0 +1,39 @@
+#include <iostream>
+#include "frame_buffer_cache.hpp"
+
+using namespace libcamera;
+
+bool FrameBufferCache::add(const FrameBuffer *buffer, Image::MapMode mode, const StreamConfiguration &config)
+{
+    std::unique_ptr<Image> mapping = Image::fromFrameBuffer(buffer, mode, config);
+    if (!mapping)
+    {
+        std::cerr << "Failed to map frame buffer" << std::endl;
+        return false;
+    }
+
+    std::vector<Span<uint8_t>> planes;
+    for (unsigned int i = 0; i < mapping->numPlanes(); i++)
+        planes.push_back(mapping->data(i));
+
+    MappedBuffer &entry = m_buffers[buffer];
+    entry.view = Image::fromPlanes(planes, config);
+    entry.mapping = std::move(mapping);
+    return true;
+}
+
+Image *FrameBufferCache::find(const FrameBuffer *buffer) const
+{
+    auto iter = m_buffers.find(buffer);
+    if (iter == m_buffers.end())
+        return nullptr;
+    return iter->second.view.get();
+}
+
+void FrameBufferCache::clear()
+{
+    // Views first, they point into the mappings
+    for (auto &entry : m_buffers)
+        entry.second.view.reset();
+    m_buffers.clear();
+}
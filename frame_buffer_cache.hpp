@@ -0,0 +1,27 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <libcamera/framebuffer.h>
+#include <libcamera/stream.h>
+#include "image.h"
+
+/*
+ * libcamera hands the same FrameBuffers back to us for every request, so
+ * each one is mapped once when the stream's buffers are allocated. Completed
+ * requests then look up a non-owning Image view of the mapping, which keeps
+ * mmap, munmap and lseek off the per-frame path.
+ */
+class FrameBufferCache {
+    struct MappedBuffer {
+        std::unique_ptr<Image> mapping;
+        std::unique_ptr<Image> view;
+    };
+    std::map<const libcamera::FrameBuffer *, MappedBuffer> m_buffers;
+
+    public:
+        bool add(const libcamera::FrameBuffer *buffer, Image::MapMode mode,
+                 const libcamera::StreamConfiguration &config);
+        Image *find(const libcamera::FrameBuffer *buffer) const;
+        void clear();
+};
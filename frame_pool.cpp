@@ -0,0 +1,32 @@
+#include "frame_pool.hpp"
+
+FramePool::FramePool(size_t count, size_t bufferSize)
+    : m_buffer_size(bufferSize)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        m_storage.push_back(std::make_unique<uint8_t[]>(bufferSize));
+        m_free.push_back(m_storage.back().get());
+    }
+}
+
+uint8_t *FramePool::tryAcquire()
+{
+    std::unique_lock lock(m_lock);
+    if (m_free.empty())
+        return nullptr;
+    uint8_t *buffer = m_free.back();
+    m_free.pop_back();
+    return buffer;
+}
+
+void FramePool::release(uint8_t *buffer)
+{
+    std::unique_lock lock(m_lock);
+    m_free.push_back(buffer);
+}
+
+size_t FramePool::bufferSize() const
+{
+    return m_buffer_size;
+}
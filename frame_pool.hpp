@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Fixed set of preallocated full resolution frame buffers for stills.
+ * Image::copyFromImage takes a buffer from the pool and the Image hands it
+ * back when image_writer is done with it. When the writer can't keep up
+ * and every buffer is in use, tryAcquire() returns nullptr so the caller
+ * can drop the still rather than stall the capture thread or grow memory
+ * without limit.
+ */
+class FramePool {
+    std::vector<std::unique_ptr<uint8_t[]>> m_storage;
+    std::vector<uint8_t *> m_free;
+    size_t m_buffer_size;
+    std::mutex m_lock;
+
+    public:
+        FramePool(size_t count, size_t bufferSize);
+        uint8_t *tryAcquire();
+        void release(uint8_t *buffer);
+        size_t bufferSize() const;
+};
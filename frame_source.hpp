@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <libcamera/controls.h>
+#include "frame_pool.hpp"
+#include "image.h"
+
+#define VIEWFINDER_COOKIE 0x0001
+#define STILL_CAPTURE_COOKIE 0x0010
+
+// A completed frame, handed from a FrameSource to the processing side
+struct CapturedFrame
+{
+    uint64_t cookie = 0;
+    // the source's mapping of the pixels, valid until the frame is released
+    Image *image = nullptr;
+    CaptureInfo info;
+    // the request's full metadata, camera frames only
+    const libcamera::ControlList *metadata = nullptr;
+    // the source's own reference for recycling the frame
+    void *handle = nullptr;
+};
+
+// Called on the source's own thread as each frame completes
+using FrameHandler = std::function<void(const CapturedFrame &)>;
+
+/*
+ * Where viewfinder and still frames come from: the camera, or a
+ * recording when there isn't one. Every frame handed to the FrameHandler
+ * has to be given back with release() once its image is finished with.
+ */
+class FrameSource {
+    public:
+        virtual ~FrameSource() = default;
+        virtual void start() = 0;
+        virtual void requestStillFrame() = 0;
+        virtual void release(const CapturedFrame &frame) = 0;
+        // Buffers sized for one still, to copy stills into for the writer
+        virtual std::shared_ptr<FramePool> stillPool() const = 0;
+};
@@ -0,0 +1,227 @@
+#include "frame_trace.hpp"
+
+#if FRAME_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+struct TraceEvent
+{
+    uint64_t time_ns;
+    uint32_t sequence;
+    TraceStage stage;
+};
+
+/*
+ * One per thread. Only the owning thread writes, publishing each event
+ * by bumping written, so the reader needs nothing more than an acquire
+ * load to see whole events.
+ */
+struct TraceRing
+{
+    pid_t tid;
+    std::string name;
+    TraceEvent events[FRAME_TRACE_RING_SIZE];
+    std::atomic<uint64_t> written{0};
+};
+
+static const char *stage_names[] = {
+    "sensor", "request complete", "dispatch", "convert", "requeue", "draw",
+};
+
+// The stage each one is timed from, falling back further when that wasn't recorded
+static const TraceStage predecessors[] = {
+    TraceStage::Sensor,
+    TraceStage::Sensor,
+    TraceStage::RequestComplete,
+    TraceStage::Dispatch,
+    TraceStage::ConvertEnd,
+    TraceStage::ConvertEnd,
+};
+
+static_assert(sizeof(stage_names) / sizeof(stage_names[0]) == (size_t)TraceStage::Count);
+static_assert(sizeof(predecessors) / sizeof(predecessors[0]) == (size_t)TraceStage::Count);
+
+// Rings outlive their threads, so a finished worker's events still get reported
+static std::mutex registry_lock;
+static std::vector<std::shared_ptr<TraceRing>> rings;
+
+static TraceRing &this_thread_ring()
+{
+    thread_local std::shared_ptr<TraceRing> ring = [] {
+        auto created = std::make_shared<TraceRing>();
+        created->tid = gettid();
+        char name[16] = {};
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+            created->name = name;
+        std::lock_guard lock(registry_lock);
+        rings.push_back(created);
+        return created;
+    }();
+    return *ring;
+}
+
+uint64_t trace_clock_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void trace_frame(TraceStage stage, uint32_t sequence)
+{
+    trace_frame(stage, sequence, trace_clock_ns());
+}
+
+void trace_frame(TraceStage stage, uint32_t sequence, uint64_t timeNs)
+{
+    TraceRing &ring = this_thread_ring();
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    ring.events[index % FRAME_TRACE_RING_SIZE] = {timeNs, sequence, stage};
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+namespace {
+
+// Everything recorded about one frame
+struct FrameRecord
+{
+    uint64_t times[(size_t)TraceStage::Count] = {};
+    pid_t tids[(size_t)TraceStage::Count] = {};
+};
+
+// The stage s is timed from, or Count when nothing before it was recorded
+TraceStage timed_from(const FrameRecord &frame, TraceStage stage)
+{
+    while (stage != TraceStage::Sensor)
+    {
+        stage = predecessors[(size_t)stage];
+        if (frame.times[(size_t)stage])
+            return stage;
+    }
+    return TraceStage::Count;
+}
+
+std::map<uint32_t, FrameRecord> collect_frames(std::vector<std::pair<pid_t, std::string>> &threads)
+{
+    std::map<uint32_t, FrameRecord> frames;
+    std::lock_guard lock(registry_lock);
+    for (const auto &ring : rings)
+    {
+        threads.emplace_back(ring->tid, ring->name);
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t first = written > FRAME_TRACE_RING_SIZE ? written - FRAME_TRACE_RING_SIZE : 0;
+        for (uint64_t i = first; i < written; i++)
+        {
+            const TraceEvent &event = ring->events[i % FRAME_TRACE_RING_SIZE];
+            FrameRecord &frame = frames[event.sequence];
+            frame.times[(size_t)event.stage] = event.time_ns;
+            frame.tids[(size_t)event.stage] = ring->tid;
+        }
+    }
+    return frames;
+}
+
+}
+
+bool write_chrome_trace(const std::string &filename)
+{
+    std::vector<std::pair<pid_t, std::string>> threads;
+    std::map<uint32_t, FrameRecord> frames = collect_frames(threads);
+
+    std::ofstream out(filename);
+    if (!out)
+        return false;
+
+    const pid_t pid = getpid();
+    bool first = true;
+    auto separator = [&out, &first]() -> std::ostream & {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        return out;
+    };
+
+    out << "{\"traceEvents\": [";
+    for (const auto &[tid, name] : threads)
+    {
+        separator() << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << pid << ", \"tid\": " << tid
+                    << ", \"args\": {\"name\": \"" << (name.empty() ? "thread" : name) << "\"}}";
+    }
+
+    // one slice per stage, from the stage it follows on the thread that recorded it
+    out << std::fixed << std::setprecision(3);
+    for (const auto &[sequence, frame] : frames)
+    {
+        for (size_t stage = (size_t)TraceStage::RequestComplete; stage < (size_t)TraceStage::Count; stage++)
+        {
+            if (!frame.times[stage])
+                continue;
+            TraceStage from = timed_from(frame, (TraceStage)stage);
+            if (from == TraceStage::Count)
+                continue;
+            uint64_t begin = frame.times[(size_t)from];
+            uint64_t end = std::max(frame.times[stage], begin);
+            separator() << "{\"ph\": \"X\", \"name\": \"" << stage_names[stage] << "\", \"pid\": " << pid
+                        << ", \"tid\": " << frame.tids[stage] << ", \"ts\": " << begin / 1000.0
+                        << ", \"dur\": " << (end - begin) / 1000.0
+                        << ", \"args\": {\"frame\": " << sequence << "}}";
+        }
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+void print_trace_summary(std::ostream &out)
+{
+    std::vector<std::pair<pid_t, std::string>> threads;
+    std::map<uint32_t, FrameRecord> frames = collect_frames(threads);
+
+    // each stage's latency, plus sensor to panel in the last slot
+    std::vector<uint64_t> latencies[(size_t)TraceStage::Count + 1];
+    for (const auto &[sequence, frame] : frames)
+    {
+        for (size_t stage = (size_t)TraceStage::RequestComplete; stage < (size_t)TraceStage::Count; stage++)
+        {
+            TraceStage from = timed_from(frame, (TraceStage)stage);
+            if (frame.times[stage] && from != TraceStage::Count && frame.times[stage] >= frame.times[(size_t)from])
+                latencies[stage].push_back(frame.times[stage] - frame.times[(size_t)from]);
+        }
+        const uint64_t sensor = frame.times[(size_t)TraceStage::Sensor];
+        const uint64_t drawn = frame.times[(size_t)TraceStage::DrawEnd];
+        if (sensor && drawn >= sensor)
+            latencies[(size_t)TraceStage::Count].push_back(drawn - sensor);
+    }
+
+    out << "Frame latency over " << frames.size() << " frames (ms)" << std::endl
+        << std::left << std::setw(20) << "stage" << std::right << std::setw(8) << "frames"
+        << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (size_t stage = (size_t)TraceStage::RequestComplete; stage <= (size_t)TraceStage::Count; stage++)
+    {
+        std::vector<uint64_t> &values = latencies[stage];
+        out << std::left << std::setw(20) << (stage == (size_t)TraceStage::Count ? "sensor to panel" : stage_names[stage])
+            << std::right << std::setw(8) << values.size();
+        if (values.empty())
+        {
+            out << std::endl;
+            continue;
+        }
+        std::sort(values.begin(), values.end());
+        auto percentile = [&values](double p) {
+            return values[std::min(values.size() - 1, (size_t)(p * values.size()))] / 1e6;
+        };
+        out << std::setw(10) << percentile(0.50) << std::setw(10) << percentile(0.99)
+            << std::setw(10) << values.back() / 1e6 << std::endl;
+    }
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Set to 1 (or pass -DFRAME_TRACE=1) to time every viewfinder frame through the pipeline
+#ifndef FRAME_TRACE
+#define FRAME_TRACE (0)
+#endif
+
+// Events each thread keeps, the oldest are overwritten once it fills
+#define FRAME_TRACE_RING_SIZE 8192
+// Sequence number for frames that aren't traced, such as stills
+#define TRACE_NO_FRAME UINT32_MAX
+
+/*
+ * Where a viewfinder frame has got to, in the order they happen. The
+ * buffer is requeued as soon as it's converted, so DrawEnd, on the
+ * display thread, follows on from ConvertEnd rather than Requeue.
+ */
+enum class TraceStage : uint8_t {
+    Sensor,          // FrameMetadata::timestamp
+    RequestComplete, // the completed request reached the frame source
+    Dispatch,        // the event loop picked up the queued call
+    ConvertEnd,      // converted into the display worker's back buffer
+    Requeue,         // the buffer went back to the frame source
+    DrawEnd,         // the panel transfer finished
+    Count,
+};
+
+#if FRAME_TRACE
+
+// CLOCK_MONOTONIC, the clock libcamera's timestamps are on
+uint64_t trace_clock_ns();
+
+/*
+ * Records that frame sequence reached stage, now or at timeNs. Each
+ * thread appends to its own ring, so recording takes no lock and never
+ * allocates after the thread's first event.
+ */
+void trace_frame(TraceStage stage, uint32_t sequence);
+void trace_frame(TraceStage stage, uint32_t sequence, uint64_t timeNs);
+
+/*
+ * Reporting, once the pipeline has stopped. The Chrome trace has a track
+ * per thread with a slice per stage, for chrome://tracing or Perfetto.
+ * The summary is p50/p99 of each stage's time since the previous one.
+ */
+bool write_chrome_trace(const std::string &filename);
+void print_trace_summary(std::ostream &out);
+
+#else
+
+inline uint64_t trace_clock_ns() { return 0; }
+inline void trace_frame(TraceStage, uint32_t) {}
+inline void trace_frame(TraceStage, uint32_t, uint64_t) {}
+
+#endif
@@ -0,0 +1,41 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "gpio_registers.hpp"
+
+#define GPIO_DEVICE "/dev/gpiomem"
+#define GPIO_BLOCK_SIZE 4096
+
+MappedGpioRegisters::MappedGpioRegisters()
+{
+    int fd = open(GPIO_DEVICE, O_RDWR | O_SYNC);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << GPIO_DEVICE << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    void *address = mmap(nullptr, GPIO_BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED)
+    {
+        std::cerr << "Failed to mmap " << GPIO_DEVICE << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    m_base = static_cast<volatile uint32_t *>(address);
+}
+
+MappedGpioRegisters::~MappedGpioRegisters()
+{
+    if (m_base)
+        munmap(const_cast<uint32_t *>(m_base), GPIO_BLOCK_SIZE);
+}
+
+void MappedGpioRegisters::setOutput(int pin)
+{
+    volatile uint32_t *fsel = m_base + GPIO_GPFSEL0 / 4 + pin / 10;
+    *fsel = (*fsel & ~(7u << (pin % 10) * 3)) | (GPIO_FSEL_OUTPUT << (pin % 10) * 3);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// BCM283x GPIO register block, byte offsets
+#define GPIO_GPFSEL0 0x00
+#define GPIO_GPSET0 0x1C
+#define GPIO_GPCLR0 0x28
+#define GPIO_GPLEV0 0x34
+#define GPIO_REGISTER_WORDS (0xB4 / 4)
+
+#define GPIO_FSEL_OUTPUT 1
+
+/*
+ * The GPIO block mapped through /dev/gpiomem, so pins can be driven with
+ * single register stores instead of a wiringPi call per pin. set() and
+ * clear() take a mask of BCM pins 0-31. Pi 5 moved its GPIO to the RP1
+ * and isn't covered, isMapped() is false there and callers fall back.
+ */
+class MappedGpioRegisters {
+    volatile uint32_t *m_base = nullptr;
+
+    public:
+        MappedGpioRegisters();
+        MappedGpioRegisters(const MappedGpioRegisters &) = delete;
+        MappedGpioRegisters &operator=(const MappedGpioRegisters &) = delete;
+        ~MappedGpioRegisters();
+
+        bool isMapped() const { return m_base != nullptr; }
+        void setOutput(int pin);
+        inline void set(uint32_t mask) { m_base[GPIO_GPSET0 / 4] = mask; }
+        inline void clear(uint32_t mask) { m_base[GPIO_GPCLR0 / 4] = mask; }
+};
+
+/*
+ * Plain memory with the same layout, for exercising register level code
+ * off the Pi. Set and clear stores update the level register the way the
+ * hardware would. onStore sees each store as it's made, with the byte
+ * offset of the register, and onChange every new level, e.g. to decode
+ * what a bus put on its pins at each strobe.
+ */
+class FakeGpioRegisters {
+    public:
+        uint32_t memory[GPIO_REGISTER_WORDS] = {};
+        std::function<void(unsigned int offset, uint32_t mask)> onStore;
+        std::function<void(uint32_t before, uint32_t after)> onChange;
+
+        bool isMapped() const { return true; }
+        void setOutput(int pin)
+        {
+            uint32_t &fsel = memory[GPIO_GPFSEL0 / 4 + pin / 10];
+            fsel = (fsel & ~(7u << (pin % 10) * 3)) | (GPIO_FSEL_OUTPUT << (pin % 10) * 3);
+        }
+        void set(uint32_t mask)
+        {
+            memory[GPIO_GPSET0 / 4] = mask;
+            if (onStore)
+                onStore(GPIO_GPSET0, mask);
+            update(level() | mask);
+        }
+        void clear(uint32_t mask)
+        {
+            memory[GPIO_GPCLR0 / 4] = mask;
+            if (onStore)
+                onStore(GPIO_GPCLR0, mask);
+            update(level() & ~mask);
+        }
+        uint32_t level() const { return memory[GPIO_GPLEV0 / 4]; }
+
+    private:
+        void update(uint32_t level)
+        {
+            uint32_t before = memory[GPIO_GPLEV0 / 4];
+            memory[GPIO_GPLEV0 / 4] = level;
+            if (onChange)
+                onChange(before, level);
+        }
+};
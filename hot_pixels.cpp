@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <string.h>
+#include "hot_pixels.hpp"
+#include "dng_writer.hpp"
+
+#define HOT_PIXEL_MAGIC 0x50485041 // "APHP"
+#define HOT_PIXEL_VERSION 1
+// how far above the dark frame's median a pixel has to be to count as hot
+#define HOT_PIXEL_SIGMA 6.0
+#define HOT_PIXEL_MIN_EXCESS (1.0 / 64)
+#define HOT_PIXEL_MAD_TO_SIGMA 1.4826
+
+struct HotPixelHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t count;
+};
+
+static inline uint32_t load_sample(const uint8_t *row, int x, bool bayer)
+{
+    if (bayer)
+    {
+        uint16_t sample;
+        memcpy(&sample, row + x * 2, 2);
+        return sample;
+    }
+    return std::max({row[x * 3], row[x * 3 + 1], row[x * 3 + 2]});
+}
+
+HotPixelMap HotPixelMap::detect(const Image &dark)
+{
+    HotPixelMap map;
+    map.m_width = dark.width();
+    map.m_height = dark.height();
+    map.m_format = dark.format();
+
+    const bool bayer = dark.isBayer();
+    const uint32_t fullScale = bayer ? DNG_WHITE_LEVEL : UINT8_MAX;
+    const uint8_t *plane = dark.data(0).data();
+    // each Bayer colour has its own dark level, RGB pixels use a single one
+    auto channel = [bayer](int x, int y) { return bayer ? (y & 1) * 2 + (x & 1) : 0; };
+
+    // median and median absolute deviation, so the hot pixels themselves don't skew the threshold
+    std::vector<size_t> histograms[4];
+    for (auto &histogram : histograms)
+        histogram.assign(fullScale + 1, 0);
+    size_t counts[4] = {};
+    for (int y = 0; y < map.m_height; y++)
+    {
+        const uint8_t *row = plane + (size_t)y * dark.stride();
+        for (int x = 0; x < map.m_width; x++)
+        {
+            int c = channel(x, y);
+            histograms[c][std::min<uint32_t>(load_sample(row, x, bayer), fullScale)]++;
+            counts[c]++;
+        }
+    }
+
+    auto percentile = [](const std::vector<size_t> &histogram, size_t count) {
+        size_t seen = 0;
+        for (size_t value = 0; value < histogram.size(); value++)
+        {
+            seen += histogram[value];
+            if (seen * 2 > count)
+                return value;
+        }
+        return histogram.size() - 1;
+    };
+
+    double thresholds[4] = {};
+    for (int c = 0; c < 4; c++)
+    {
+        if (!counts[c])
+            continue;
+        size_t median = percentile(histograms[c], counts[c]);
+        std::vector<size_t> deviations(histograms[c].size(), 0);
+        for (size_t value = 0; value < histograms[c].size(); value++)
+            deviations[value > median ? value - median : median - value] += histograms[c][value];
+        double sigma = HOT_PIXEL_MAD_TO_SIGMA * percentile(deviations, counts[c]);
+        thresholds[c] = median + std::max(HOT_PIXEL_SIGMA * sigma, HOT_PIXEL_MIN_EXCESS * fullScale);
+    }
+
+    for (int y = 0; y < map.m_height; y++)
+    {
+        const uint8_t *row = plane + (size_t)y * dark.stride();
+        for (int x = 0; x < map.m_width; x++)
+        {
+            if (load_sample(row, x, bayer) > thresholds[channel(x, y)])
+                map.m_pixels.push_back((uint32_t)y * map.m_width + x);
+        }
+    }
+    // scanned in index order, so the list is already sorted
+    return map;
+}
+
+bool HotPixelMap::load(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        return false;
+
+    HotPixelHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != HOT_PIXEL_MAGIC || header.version != HOT_PIXEL_VERSION)
+    {
+        std::cerr << filename << " is not a hot pixel map" << std::endl;
+        return false;
+    }
+
+    // correct() indexes the plane with these, so nothing in the file is trusted
+    const uint64_t pixelCount = (uint64_t)header.width * header.height;
+    if (!header.width || !header.height || header.width > INT_MAX || header.height > INT_MAX ||
+        pixelCount > (uint64_t)UINT32_MAX + 1 || header.count > pixelCount)
+    {
+        std::cerr << filename << " has a bad size or hot pixel count" << std::endl;
+        return false;
+    }
+
+    // check the length before sizing anything from the header
+    file.seekg(0, std::ios::end);
+    const uint64_t fileSize = file.tellg();
+    file.seekg(sizeof(header));
+    if (fileSize < sizeof(header) + (uint64_t)header.count * sizeof(uint32_t))
+    {
+        std::cerr << filename << " is truncated" << std::endl;
+        return false;
+    }
+
+    std::vector<uint32_t> pixels(header.count);
+    if (!file.read(reinterpret_cast<char *>(pixels.data()), pixels.size() * sizeof(uint32_t)) ||
+        !std::is_sorted(pixels.begin(), pixels.end()) ||
+        (!pixels.empty() && pixels.back() >= pixelCount))
+    {
+        std::cerr << filename << " is truncated or corrupt" << std::endl;
+        return false;
+    }
+
+    m_width = header.width;
+    m_height = header.height;
+    m_format = static_cast<PixelColourFormat>(header.format);
+    m_pixels = std::move(pixels);
+    return true;
+}
+
+bool HotPixelMap::save(const std::string &filename) const
+{
+    HotPixelHeader header = {HOT_PIXEL_MAGIC, HOT_PIXEL_VERSION, (uint32_t)m_width, (uint32_t)m_height,
+                             (uint32_t)m_format, (uint32_t)m_pixels.size()};
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(m_pixels.data()), m_pixels.size() * sizeof(uint32_t));
+    if (!file)
+    {
+        std::cerr << "Failed to write " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+size_t HotPixelMap::size() const
+{
+    return m_pixels.size();
+}
+
+bool HotPixelMap::matches(const Image &image) const
+{
+    return image.width() == m_width && image.height() == m_height && image.format() == m_format;
+}
+
+bool HotPixelMap::isHot(int x, int y) const
+{
+    return std::binary_search(m_pixels.begin(), m_pixels.end(), (uint32_t)y * m_width + x);
+}
+
+void HotPixelMap::correct(Image &image) const
+{
+    if (m_pixels.empty())
+        return;
+    if (!matches(image))
+    {
+        std::cerr << "Hot pixel map doesn't match a " << image.width() << "x" << image.height()
+                  << " still, not correcting it" << std::endl;
+        return;
+    }
+
+    const bool bayer = image.isBayer();
+    // same-colour photosites are two apart in a Bayer mosaic
+    const int step = bayer ? 2 : 1;
+    const int channels = bayer ? 1 : 3;
+    const unsigned int stride = image.stride();
+    uint8_t *plane = image.data(0).data();
+
+    for (uint32_t index : m_pixels)
+    {
+        int x = index % m_width;
+        int y = index / m_width;
+
+        for (int c = 0; c < channels; c++)
+        {
+            uint32_t neighbours[8];
+            int count = 0;
+            for (int dy = -step; dy <= step; dy += step)
+            {
+                for (int dx = -step; dx <= step; dx += step)
+                {
+                    int nx = x + dx, ny = y + dy;
+                    if ((!dx && !dy) || nx < 0 || ny < 0 || nx >= m_width || ny >= m_height || isHot(nx, ny))
+                        continue;
+                    const uint8_t *row = plane + (size_t)ny * stride;
+                    if (bayer)
+                        neighbours[count++] = load_sample(row, nx, true);
+                    else
+                        neighbours[count++] = row[nx * 3 + c];
+                }
+            }
+            if (!count)
+                continue;
+
+            std::nth_element(neighbours, neighbours + count / 2, neighbours + count);
+            uint32_t median = neighbours[count / 2];
+            uint8_t *row = plane + (size_t)y * stride;
+            if (bayer)
+            {
+                uint16_t sample = median;
+                memcpy(row + x * 2, &sample, 2);
+            }
+            else
+            {
+                row[x * 3 + c] = median;
+            }
+        }
+    }
+}
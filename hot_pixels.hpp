@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "image.h"
+
+/*
+ * Stuck pixels found in a dark frame, kept as a sorted list of pixel
+ * indices (y * width + x) so correction only visits the listed pixels
+ * and can look up whether a neighbour is also hot with a binary search.
+ * For Bayer frames a pixel is one photosite and it is replaced with the
+ * median of its same-colour neighbours; for RGB frames each channel is
+ * replaced with the median of the 8 surrounding pixels.
+ */
+class HotPixelMap {
+    int m_width = 0;
+    int m_height = 0;
+    PixelColourFormat m_format;
+    std::vector<uint32_t> m_pixels;
+
+    public:
+        static HotPixelMap detect(const Image &dark);
+
+        bool load(const std::string &filename);
+        bool save(const std::string &filename) const;
+
+        size_t size() const;
+        bool matches(const Image &image) const;
+        bool isHot(int x, int y) const;
+        void correct(Image &image) const;
+};
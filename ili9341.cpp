@@ -1,15 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wiringPi.h>
+#include <algorithm>
 #include <iostream>
 #include "ili9341.hpp"
 
 
 #define SPI_SPEED 64000000
 
-#define BYTES_PER_PIXEL 3
 #define BUFFER_STRIDE 4
+// send each frame as one window and one bulk write rather than BUFFER_STRIDE row strips
+#define FULL_FRAME_WRITES (1)
 
 #define MADCTL_MY 0x80  ///< Bottom to top
 #define MADCTL_MX 0x40  ///< Right to left
@@ -22,17 +23,19 @@
 #define MAD_VALUE (MADCTL_MV | MADCTL_BGR)
 
 
-ILI9341::ILI9341(const char *spi_dev, int cs, int dc, int rst, int backlight)
-    : Display(spi_dev, SPI_SPEED, cs, dc, rst)
+ILI9341::ILI9341(std::unique_ptr<DisplayBus> bus)
+    : Display(std::move(bus), SPI_SPEED)
 {
-    pinMode(backlight, OUTPUT);
-    digitalWrite(backlight, HIGH);
+    init();
+}
 
+void ILI9341::init()
+{
     // INIT DISPLAY ------------------------------------------------------------
     reset();
 
     sendCommand(ILI9341_SWRESET);
-    delay(50);
+    m_bus->delay(50);
     sendCommand(ILI9341_DISPOFF);
     sendCommand(0xEF, 0x03, 0x80, 0x02);
     sendCommand(0xCF, 0x00, 0xC1, 0x30);
@@ -64,44 +67,71 @@ ILI9341::ILI9341(const char *spi_dev, int cs, int dc, int rst, int backlight)
     sendCommand(buffer2, 15, ILI9341_GMCTRN1);
 
     sendCommand(ILI9341_SLPOUT);                // Exit Sleep
-    delay(150);
+    m_bus->delay(150);
     sendCommand(ILI9341_DISPON);                // Display on
-    delay(200);
+    m_bus->delay(200);
 
     fillWithColour(0x0); // black / clear the screen
 }
 
 void ILI9341::drawImage(libcamera::Span<uint8_t>& data)
 {
+    if (this->drawChangedTiles(data, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT, m_bytes_per_pixel))
+        return;
+
     uint8_t *buffer = data.data();
+#if FULL_FRAME_WRITES
+    size_t frameSize = ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT * m_bytes_per_pixel;
+    this->setAddrWindow(0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT);
+    this->sendBulkData(buffer, std::min(data.size(), frameSize));
+#else
     for (uint16_t y = 0; y < ILI9341_TFTHEIGHT; y += BUFFER_STRIDE)
     {
         this->setAddrWindow(0, y, ILI9341_TFTWIDTH, BUFFER_STRIDE);
-        this->sendData(&buffer[y*ILI9341_TFTWIDTH*BYTES_PER_PIXEL], BUFFER_STRIDE*ILI9341_TFTWIDTH*BYTES_PER_PIXEL);
+        this->sendData(&buffer[y*ILI9341_TFTWIDTH*m_bytes_per_pixel], BUFFER_STRIDE*ILI9341_TFTWIDTH*m_bytes_per_pixel);
     }
+#endif
+}
+
+/*
+ * Sends the window commands and the frame as one batch from the I/O
+ * thread. Delta updates compare against the previous frame as they go,
+ * so those stay synchronous.
+ */
+TransferToken ILI9341::drawImageAsync(libcamera::Span<uint8_t>& data)
+{
+#if FULL_FRAME_WRITES
+    if (!this->m_delta_mode)
+    {
+        size_t frameSize = ILI9341_TFTWIDTH * ILI9341_TFTHEIGHT * m_bytes_per_pixel;
+        SpiBatch batch;
+        this->queueAddrWindow(batch, 0, 0, ILI9341_TFTWIDTH, ILI9341_TFTHEIGHT);
+        batch.data(data.data(), std::min(data.size(), frameSize));
+        return this->submit(std::move(batch));
+    }
+#endif
+    return Display::drawImageAsync(data);
 }
 
 void ILI9341::drawPixel(int16_t x, int16_t y, uint32_t colour)
 {
+    this->invalidateFrame();
     if ((x >= 0) && (x < ILI9341_TFTWIDTH) && (y >= 0) && (y < ILI9341_TFTHEIGHT)) {
-        uint8_t buffer[2] = {(uint8_t)(colour>>8), (uint8_t) (colour & 0x00FF)};
+        uint8_t buffer[3];
+        colour_to_pixel(colour, buffer, m_bytes_per_pixel);
         this->setAddrWindow(x, y, 1, 1);
-        this->sendData(buffer, 2);
+        this->sendData(buffer, m_bytes_per_pixel);
     }
 }
 
 void ILI9341::fillWithColour(uint32_t colour)
 {
-    uint32_t bufferSize = ILI9341_TFTWIDTH * BYTES_PER_PIXEL * BUFFER_STRIDE;
+    this->invalidateFrame();
+    uint32_t bufferSize = ILI9341_TFTWIDTH * m_bytes_per_pixel * BUFFER_STRIDE;
     uint8_t buffer[bufferSize];
-    for (uint32_t i = 0; i < bufferSize; i+=BYTES_PER_PIXEL)
+    for (uint32_t i = 0; i < bufferSize; i+=m_bytes_per_pixel)
     {
-        // uint16_t rgb565 = (((colour&0xf80000)>>8)|((colour&0xfc00)>>5)|((colour&0xf8)>>3));
-        // buffer[i] = (uint8_t)(rgb565 >> 8);
-        // buffer[i+1] = (uint8_t)(rgb565);
-        buffer[i]   = (uint8_t)((colour >> 16) & 0xFF);
-        buffer[i+1] = (uint8_t)((colour >> 8)  & 0xFF);
-        buffer[i+2] = (uint8_t)((colour >> 0)  & 0xFF);
+        colour_to_pixel(colour, &buffer[i], m_bytes_per_pixel);
     }
 
     for (uint8_t y = 0; y < ILI9341_TFTHEIGHT; y += BUFFER_STRIDE)
@@ -111,6 +141,14 @@ void ILI9341::fillWithColour(uint32_t colour)
     }
 }
 
+bool ILI9341::setRgb565(bool enabled)
+{
+    this->sendCommand(ILI9341_PIXFMT, enabled ? 0x55 : 0x66); // 16 or 18 bits per pixel
+    this->m_bytes_per_pixel = enabled ? 2 : 3;
+    this->invalidateFrame();
+    return true;
+}
+
 void ILI9341::displayOff()
 {
     this->sendCommand(ILI9341_DISPOFF, 0x80);
@@ -132,22 +170,26 @@ void ILI9341::displayOff()
 */
 void ILI9341::setAddrWindow(uint16_t x1, uint16_t y1, uint16_t w, uint16_t h)
 {
-    static uint16_t old_x1 = 0xffff, old_x2 = 0xffff;
-    static uint16_t old_y1 = 0xffff, old_y2 = 0xffff;
+    SpiBatch batch;
+    this->queueAddrWindow(batch, x1, y1, w, h);
+    this->sendBatch(batch);
+}
 
+void ILI9341::queueAddrWindow(SpiBatch &batch, uint16_t x1, uint16_t y1, uint16_t w, uint16_t h)
+{
     uint16_t x2 = (x1 + w - 1), y2 = (y1 + h - 1);
-    if (x1 != old_x1 || x2 != old_x2) {
+    if (x1 != m_window_x1 || x2 != m_window_x2) {
         uint8_t xargs[4] = { (uint8_t)(x1 >> 8), (uint8_t)x1, (uint8_t)(x2 >> 8), (uint8_t)x2};
-        sendCommand(xargs, 4, ILI9341_CASET); // Column address set
-        old_x1 = x1;
-        old_x2 = x2;
+        batch.command(ILI9341_CASET, xargs, 4); // Column address set
+        m_window_x1 = x1;
+        m_window_x2 = x2;
     }
-    if (y1 != old_y1 || y2 != old_y2) {
+    if (y1 != m_window_y1 || y2 != m_window_y2) {
         uint8_t yargs[4] = { (uint8_t)(y1 >> 8), (uint8_t)y1, (uint8_t)(y2 >> 8), (uint8_t)y2};
-        sendCommand(yargs, 4, ILI9341_PASET); // Row address set
-        old_y1 = y1;
-        old_y2 = y2;
+        batch.command(ILI9341_PASET, yargs, 4); // Row address set
+        m_window_y1 = y1;
+        m_window_y2 = y2;
     }
-    sendCommand(ILI9341_RAMWR); // Write to RAM
+    batch.command(ILI9341_RAMWR); // Write to RAM
 }
 
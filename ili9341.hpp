@@ -84,12 +84,22 @@
 #define ILI9341_PINK 0xFC18        ///< 255, 130, 198
 
 class ILI9341 : public Display {
+        // last address window sent, so unchanged CASET/PASET can be skipped
+        uint16_t m_window_x1 = 0xffff, m_window_x2 = 0xffff;
+        uint16_t m_window_y1 = 0xffff, m_window_y2 = 0xffff;
+
     public:
-        ILI9341(const char *spi_dev, int cs, int dc, int rst = -1, int backlight = 18);
+        // On a SpidevBus, which also owns the backlight pin, or a RecordingBus
+        ILI9341(std::unique_ptr<DisplayBus> bus);
         void drawImage(libcamera::Span<uint8_t>& data) override;
+        TransferToken drawImageAsync(libcamera::Span<uint8_t>& data) override;
         void drawPixel(int16_t x, int16_t y, uint32_t color) override;
         void fillWithColour(uint32_t colour) override;
         void displayOff() override;
+        bool setRgb565(bool enabled) override;
     protected:
         void setAddrWindow(uint16_t x1, uint16_t y1, uint16_t w, uint16_t h) override;
+        void queueAddrWindow(SpiBatch &batch, uint16_t x1, uint16_t y1, uint16_t w, uint16_t h);
+    private:
+        void init();
 };
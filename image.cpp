@@ -4,16 +4,15 @@
  *
  * Multi-planar image with access to pixel data
  */
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#define STB_IMAGE_IMPLEMENTATION
-#define STBIW_WINDOWS_UTF8
-#include "stb_image.h"
-#include "stb_image_write.h"
-
 #include "image.h"
+#include "colour_convert.hpp"
+#include "dng_writer.hpp"
+#include "jpeg_writer.hpp"
 
+#include <algorithm>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <iostream>
 #include <map>
 #include <string.h>
@@ -23,7 +22,6 @@
 
 #include <libcamera/formats.h>
 
-#define IMAGE_COLOUR_SPACE_BYTES 3
 #define JPEG_IMAGE_QUALITY 90
 
 #define CLIP(X) ( (X) > 255 ? 255 : (X) < 0 ? 0 : X)
@@ -48,6 +46,7 @@ static PixelColourFormat getPixelFormat(const libcamera::PixelFormat& format)
 {
     switch (format)
     {
+        case libcamera::formats::RGB888: return PixelColourFormat::RGB888;
         case libcamera::formats::XBGR8888: return PixelColourFormat::XBGR8888;
         case libcamera::formats::RGBX8888: return PixelColourFormat::RGBX8888;
         case libcamera::formats::BGRX8888: return PixelColourFormat::BGRX8888;
@@ -150,18 +149,66 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
     return image;
 }
 
+std::unique_ptr<Image> Image::fromPlanes(
+        const std::vector<libcamera::Span<uint8_t>> &planes,
+        const libcamera::StreamConfiguration& config)
+{
+    std::unique_ptr<Image> image{new Image()};
+    image->m_width = config.size.width;
+    image->m_height = config.size.height;
+    image->m_format = getPixelFormat(config.pixelFormat);
+    image->m_stride = config.stride;
+    image->planes_ = planes;
+    return image;
+}
+
+std::unique_ptr<Image> Image::fromBuffer(std::vector<uint8_t> data, int width, int height,
+                                         unsigned int stride, PixelColourFormat format)
+{
+    std::unique_ptr<Image> image{new Image()};
+    image->m_width = width;
+    image->m_height = height;
+    image->m_format = format;
+    image->m_stride = stride;
+    image->buffers_.push_back(std::move(data));
+    image->planes_.emplace_back(image->buffers_[0].data(), image->buffers_[0].size());
+    return image;
+}
+
+std::unique_ptr<Image> Image::fromMemory(libcamera::Span<uint8_t> data, int width, int height,
+                                         unsigned int stride, PixelColourFormat format)
+{
+    std::unique_ptr<Image> image{new Image()};
+    image->m_width = width;
+    image->m_height = height;
+    image->m_format = format;
+    image->m_stride = stride;
+    image->planes_.push_back(data);
+    return image;
+}
+
 std::unique_ptr<Image> Image::copyFromFrameBuffer(
         const libcamera::FrameBuffer *buffer,
         const libcamera::StreamConfiguration& config)
 {
-    std::unique_ptr<Image> result = Image::fromFrameBuffer(buffer, MapMode::ReadOnly, config);
-    for (auto &plane : result->planes_)
+    std::unique_ptr<Image> mapped = Image::fromFrameBuffer(buffer, MapMode::ReadOnly, config);
+    if (!mapped)
+        return nullptr;
+    return copyFromImage(*mapped);
+}
+
+std::unique_ptr<Image> Image::copyFromImage(const Image &source)
+{
+    std::unique_ptr<Image> result{new Image()};
+    result->m_width = source.m_width;
+    result->m_height = source.m_height;
+    result->m_format = source.m_format;
+    result->m_stride = source.m_stride;
+    result->m_capture_info = source.m_capture_info;
+    for (auto &plane : source.planes_)
     {
-        std::vector<uint8_t> dataBuffer;
-        dataBuffer.assign(plane.begin(), plane.end());
-        result->buffers_.push_back(dataBuffer);
+        result->buffers_.emplace_back(plane.begin(), plane.end());
     }
-    result->planes_.clear();
     for (auto &dataBuffer : result->buffers_)
     {
         result->planes_.emplace_back(dataBuffer.data(), dataBuffer.size());
@@ -169,12 +216,49 @@ std::unique_ptr<Image> Image::copyFromFrameBuffer(
     return result;
 }
 
+std::unique_ptr<Image> Image::copyFromImage(const Image &source, std::shared_ptr<FramePool> pool)
+{
+    size_t length = 0;
+    for (auto &plane : source.planes_)
+        length += plane.size();
+    if (length > pool->bufferSize())
+    {
+        std::cerr << "Frame of " << length << " bytes does not fit the pool's "
+                  << pool->bufferSize() << " byte buffers" << std::endl;
+        return copyFromImage(source);
+    }
+
+    uint8_t *buffer = pool->tryAcquire();
+    if (!buffer)
+        return nullptr;
+
+    std::unique_ptr<Image> result{new Image()};
+    result->m_width = source.m_width;
+    result->m_height = source.m_height;
+    result->m_format = source.m_format;
+    result->m_stride = source.m_stride;
+    result->m_capture_info = source.m_capture_info;
+    result->m_pool_buffer = buffer;
+    result->m_pool = std::move(pool);
+
+    uint8_t *data = result->m_pool_buffer;
+    for (auto &plane : source.planes_)
+    {
+        memcpy(data, plane.data(), plane.size());
+        result->planes_.emplace_back(data, plane.size());
+        data += plane.size();
+    }
+    return result;
+}
+
 Image::Image() = default;
 
 Image::~Image()
 {
     for (Span<uint8_t> &map : maps_)
         munmap(map.data(), map.size());
+    if (m_pool)
+        m_pool->release(m_pool_buffer);
 }
 
 unsigned int Image::numPlanes() const
@@ -182,6 +266,50 @@ unsigned int Image::numPlanes() const
     return planes_.size();
 }
 
+int Image::width() const
+{
+    return m_width;
+}
+
+int Image::height() const
+{
+    return m_height;
+}
+
+unsigned int Image::stride() const
+{
+    return m_stride;
+}
+
+PixelColourFormat Image::format() const
+{
+    return m_format;
+}
+
+bool Image::isBayer() const
+{
+    switch (m_format)
+    {
+        case PixelColourFormat::SRGGB12:
+        case PixelColourFormat::SGRBG12:
+        case PixelColourFormat::SGBRG12:
+        case PixelColourFormat::SBGGR12:
+            return true;
+        default:
+            return false;
+    }
+}
+
+const CaptureInfo &Image::captureInfo() const
+{
+    return m_capture_info;
+}
+
+void Image::setCaptureInfo(const CaptureInfo &info)
+{
+    m_capture_info = info;
+}
+
 Span<uint8_t> Image::data(unsigned int plane)
 {
     assert(plane < planes_.size());
@@ -194,133 +322,208 @@ Span<const uint8_t> Image::data(unsigned int plane) const
     return planes_[plane];
 }
 
-std::vector<uint8_t> Image::dataAsRGB565()
+size_t Image::pixelCount() const
+{
+    return (size_t)m_width * m_height;
+}
+
+unsigned int Image::sourceBytesPerPixel() const
+{
+    switch (m_format)
+    {
+        case PixelColourFormat::XRGB8888: return 4;
+        case PixelColourFormat::RGB888: return 3;
+        case PixelColourFormat::YUYV: return 2;
+        default: return 0;
+    }
+}
+
+ConvertKernel Image::kernelFor(ConvertKernel xrgb8888, ConvertKernel rgb888, ConvertKernel yuyv) const
+{
+    switch (sourceBytesPerPixel())
+    {
+        case 4: return xrgb8888;
+        case 3: return rgb888;
+        case 2: return yuyv;
+        default: return nullptr;
+    }
+}
+
+/*
+ * Converts whole rows, as many as fit in output, stepping over any
+ * padding at the end of each source row. YUYV rows always hold an even
+ * number of pixels, as the kernels need.
+ */
+size_t Image::convertRows(Span<uint8_t> output, size_t bytesPerPixel, ConvertKernel kernel) const
 {
-    std::vector<uint8_t> result;
     auto plane = planes_[0];
-    for (int i = 0; i < plane.size(); i+=4) {
-        uint16_t red = plane[i+2];
-        uint16_t green = plane[i+1];
-        uint16_t blue = plane[i];
+    const size_t sourceRowLength = (size_t)m_width * sourceBytesPerPixel();
+    const size_t rowLength = (size_t)m_width * bytesPerPixel;
+    if (!kernel || m_width <= 0 || m_height <= 0 || plane.size() < sourceRowLength)
+        return 0;
+
+    size_t rows = std::min<size_t>(m_height, output.size() / rowLength);
+    rows = std::min<size_t>(rows, (plane.size() - sourceRowLength) / m_stride + 1);
+    convert_rows(kernel, plane.data(), m_stride, output.data(), bytesPerPixel, m_width, rows);
+    return rows * rowLength;
+}
+
+static void convert_xrgb8888_to_rgb565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        uint16_t red = src[2];
+        uint16_t green = src[1];
+        uint16_t blue = src[0];
         uint16_t rgb = ((red & 0xF8) << 8) | ((green & 0xFC) << 3) | ((blue >> 3) & 0x1F);
-        result.push_back((uint8_t)rgb >> 8);
-        result.push_back((uint8_t)rgb & 0xFF);
+        *dst++ = (uint8_t)(rgb >> 8);
+        *dst++ = (uint8_t)(rgb & 0xFF);
+        src += 4;
     }
-    return result;
 }
 
-// Drops the 'X' component
-std::vector<uint8_t> Image::dataAsRGB888()
+static void convert_xrgb8888_to_rgb666(const uint8_t *src, uint8_t *dst, size_t pixels)
 {
-    std::vector<uint8_t> result;
-    auto plane = planes_[0];
-    for (int i = 0; i < plane.size(); i+=4) {
-        result.push_back((uint8_t)plane[i+2] >> 2 & 0x3F); // SSD1351 Format
-        result.push_back((uint8_t)plane[i+1] >> 2 & 0x3F); // SSD1351 Format
-        result.push_back((uint8_t)plane[i]   >> 2 & 0x3F); // SSD1351 Format
+    for (size_t i = 0; i < pixels; i++) {
+        *dst++ = (uint8_t)src[2] >> 2 & 0x3F; // SSD1351 Format
+        *dst++ = (uint8_t)src[1] >> 2 & 0x3F; // SSD1351 Format
+        *dst++ = (uint8_t)src[0] >> 2 & 0x3F; // SSD1351 Format
+        src += 4;
     }
+}
+
+static void convert_rgb888_to_rgb565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        uint16_t rgb = ((src[2] & 0xF8) << 8) | ((src[1] & 0xFC) << 3) | ((src[0] >> 3) & 0x1F);
+        *dst++ = (uint8_t)(rgb >> 8);
+        *dst++ = (uint8_t)(rgb & 0xFF);
+        src += 3;
+    }
+}
+
+static void convert_rgb888_to_rgb666(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        *dst++ = src[2] >> 2; // SSD1351 Format
+        *dst++ = src[1] >> 2;
+        *dst++ = src[0] >> 2;
+        src += 3;
+    }
+}
+
+std::vector<uint8_t> Image::dataAsRGB565()
+{
+    std::vector<uint8_t> result(pixelCount() * 2);
+    result.resize(dataAsRGB565(Span<uint8_t>(result)));
     return result;
 }
 
-#define Y_OFFSET   16
-#define UV_OFFSET 128
-#define YUV2RGB_11  298
-#define YUV2RGB_12   -1
-#define YUV2RGB_13  409
-#define YUV2RGB_22 -100
-#define YUV2RGB_23 -210
-#define YUV2RGB_32  519
-#define YUV2RGB_33    0
+size_t Image::dataAsRGB565(Span<uint8_t> output)
+{
+    return convertRows(output, 2, kernelFor(convert_xrgb8888_to_rgb565, convert_rgb888_to_rgb565, nullptr));
+}
+
+std::vector<uint8_t> Image::dataAsRGB888()
+{
+    std::vector<uint8_t> result(pixelCount() * 3);
+    result.resize(dataAsRGB888(Span<uint8_t>(result)));
+    return result;
+}
 
 // Drops the 'X' component
+size_t Image::dataAsRGB888(Span<uint8_t> output)
+{
+    return convertRows(output, 3, kernelFor(convert_xrgb8888_to_rgb666, convert_rgb888_to_rgb666, nullptr));
+}
+
 std::vector<uint8_t> Image::dataAsBGR888()
 {
-    std::vector<uint8_t> result;
-    auto plane = planes_[0];
-    if (m_format == PixelColourFormat::XRGB8888)
-    {
-        for (int i = 0; i < plane.size(); i+=4) {
-            result.push_back((uint8_t)plane[i]);
-            result.push_back((uint8_t)plane[i+1]);
-            result.push_back((uint8_t)plane[i+2]);
-        }
-    }
-    else if (m_format == PixelColourFormat::YUYV)
-    {
-        int y, u, v;
-        int uv_r, uv_g, uv_b;
-        for (int i = 0; i < plane.size(); i+=4) {
-            u=plane[i+1]-UV_OFFSET;
-            v=plane[i+3]-UV_OFFSET;
-            uv_r=YUV2RGB_12*u+YUV2RGB_13*v;
-            uv_g=YUV2RGB_22*u+YUV2RGB_23*v;
-            uv_b=YUV2RGB_32*u+YUV2RGB_33*v;
-
-            // 1st pixel
-            y=YUV2RGB_11*(plane[i] -Y_OFFSET);
-            result.push_back(CLIP((y + uv_r) >> 8)); // r
-            result.push_back(CLIP((y + uv_g) >> 8)); // g
-            result.push_back(CLIP((y + uv_b) >> 8)); // b
-
-            // 2nd pixel
-            y=YUV2RGB_11*(plane[i+2] -Y_OFFSET);
-            result.push_back(CLIP((y + uv_r) >> 8)); // r
-            result.push_back(CLIP((y + uv_g) >> 8)); // g
-            result.push_back(CLIP((y + uv_b) >> 8)); // b
-        }
-    }
+    std::vector<uint8_t> result(pixelCount() * 3);
+    result.resize(dataAsBGR888(Span<uint8_t>(result)));
     return result;
 }
 
+// Drops the 'X' component
+size_t Image::dataAsBGR888(Span<uint8_t> output)
+{
+    return convertRows(output, 3, kernelFor(convert_xrgb8888_to_bgr888, convert_rgb888_to_bgr888, convert_yuyv_to_bgr888));
+}
+
 std::vector<uint8_t> Image::dataAsXXR888()
 {
-    std::vector<uint8_t> result;
-    auto plane = planes_[0];
-    if (m_format == PixelColourFormat::XRGB8888)
+    std::vector<uint8_t> result(pixelCount() * 3);
+    result.resize(dataAsXXR888(Span<uint8_t>(result)));
+    return result;
+}
+
+size_t Image::dataAsXXR888(Span<uint8_t> output)
+{
+    return convertRows(output, 3, kernelFor(convert_xrgb8888_to_xxr888, convert_rgb888_to_xxr888, convert_yuyv_to_xxr888));
+}
+
+
+std::vector<uint8_t> Image::dataAsBGR565()
+{
+    std::vector<uint8_t> result(pixelCount() * 2);
+    result.resize(dataAsBGR565(Span<uint8_t>(result)));
+    return result;
+}
+
+size_t Image::dataAsBGR565(Span<uint8_t> output)
+{
+    return convertRows(output, 2, kernelFor(convert_xrgb8888_to_bgr565, convert_rgb888_to_bgr565, convert_yuyv_to_bgr565));
+}
+
+std::vector<uint8_t> Image::dataAsXXR565()
+{
+    std::vector<uint8_t> result(pixelCount() * 2);
+    result.resize(dataAsXXR565(Span<uint8_t>(result)));
+    return result;
+}
+
+size_t Image::dataAsXXR565(Span<uint8_t> output)
+{
+    return convertRows(output, 2, kernelFor(convert_xrgb8888_to_xxr565, convert_rgb888_to_xxr565, convert_yuyv_to_xxr565));
+}
+
+size_t Image::resampleInto(Span<uint8_t> output, int width, int height,
+                           PanelFormat format, ResampleFilter filter)
+{
+    if (output.size() < (size_t)width * height * panel_bytes_per_pixel(format))
+        return 0;
+
+    ResampleInput input;
+    switch (sourceBytesPerPixel())
     {
-        for (int i = 0; i < plane.size(); i+=4) {
-            result.push_back((uint8_t)plane[i]);
-            result.push_back(0);
-            result.push_back(0);
-        }
+        case 4: input = ResampleInput::XRGB8888; break;
+        case 3: input = ResampleInput::RGB888; break;
+        case 2: input = ResampleInput::YUYV; break;
+        default: return 0;
     }
-    else if (m_format == PixelColourFormat::YUYV)
+
+    auto plane = planes_[0];
+    if (m_height <= 0 || plane.size() < (size_t)m_stride * (m_height - 1) + m_width * sourceBytesPerPixel())
+        return 0;
+    return resample_convert(plane.data(), m_width, m_height, m_stride, input,
+                            output.data(), width, height, format, filter);
+}
+
+size_t Image::dataAsPanel(Span<uint8_t> output, int width, int height,
+                          PanelFormat format, ResampleFilter filter)
+{
+    if (m_width != width || m_height != height)
+        return resampleInto(output, width, height, format, filter);
+
+    switch (format)
     {
-        int y, u, v;
-        int uv_r, uv_g, uv_b;
-        int r, g, b;
-        for (int i = 0; i < plane.size(); i+=4) {
-            u=plane[i+1]-UV_OFFSET;
-            v=plane[i+3]-UV_OFFSET;
-            uv_r=YUV2RGB_12*u+YUV2RGB_13*v;
-            uv_g=YUV2RGB_22*u+YUV2RGB_23*v;
-            uv_b=YUV2RGB_32*u+YUV2RGB_33*v;
-
-            // 1st pixel
-            y=YUV2RGB_11*(plane[i] -Y_OFFSET);
-            r = CLIP((y + uv_r) >> 8); // r
-            g = CLIP((y + uv_g) >> 8); // g
-            b = CLIP((y + uv_b) >> 8); // b
-
-            result.push_back((r + b + g) / 3);
-            result.push_back(0);
-            result.push_back(0);
-
-            // 2nd pixel
-            y=YUV2RGB_11*(plane[i+2] -Y_OFFSET);
-            r = CLIP((y + uv_r) >> 8); // r
-            g = CLIP((y + uv_g) >> 8); // g
-            b = CLIP((y + uv_b) >> 8); // b
-
-            result.push_back((r + b + g) / 3);
-            result.push_back(0);
-            result.push_back(0);
-        }
+        case PanelFormat::BGR888: return dataAsBGR888(output);
+        case PanelFormat::XXR888: return dataAsXXR888(output);
+        case PanelFormat::BGR565: return dataAsBGR565(output);
+        case PanelFormat::XXR565: return dataAsXXR565(output);
     }
-    return result;
+    return 0;
 }
 
-
 static uint8_t color565_to_r(uint16_t color) {
     return ((color & 0xF800) >> 8);  // transform to rrrrrxxx
 }
@@ -334,15 +537,35 @@ static uint8_t color565_to_b(uint16_t color) {
 void Image::writeToFile(std::string filename)
 {
     auto plane = planes_[0];
-    std::vector<uint8_t> result;
+    if (isBayer())
+    {
+        write_dng(filename, plane, m_width, m_height, m_stride, m_format);
+        return;
+    }
 
-    for (int y = 0; y < m_height; y++) {
-        for (int x = 0; x < m_width*3; x+=3) {
-            result.push_back(plane[(y*m_stride) + x + 2]);
-            result.push_back(plane[(y*m_stride) + x + 1]);
-            result.push_back(plane[(y*m_stride) + x]);
-        }
+    // encoded in restart interval bands across all cores
+    write_jpeg(filename, plane, m_width, m_height, m_stride, JpegPixelOrder::BGR, JPEG_IMAGE_QUALITY);
+}
+
+bool Image::writeRawToFile(std::string filename)
+{
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << filename << ": " << strerror(errno) << std::endl;
+        return false;
     }
 
-    stbi_write_jpg(filename.c_str(), m_width, m_height, IMAGE_COLOUR_SPACE_BYTES, result.data(), JPEG_IMAGE_QUALITY);
+    bool ok = true;
+    for (auto &plane : planes_)
+    {
+        if (write(fd, plane.data(), plane.size()) != (ssize_t)plane.size())
+        {
+            std::cerr << "Failed to write " << filename << ": " << strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    return ok;
 }
@@ -18,6 +18,10 @@
 #include <libcamera/framebuffer.h>
 #include <libcamera/stream.h>
 
+#include "colour_convert.hpp"
+#include "frame_pool.hpp"
+#include "resample.hpp"
+
 enum PixelColourFormat {
     XRGB8888,
     XBGR8888,
@@ -40,6 +44,18 @@ enum PixelColourFormat {
     SGRBG12,
     SGBRG12,
     SBGGR12,
+    // after the rest so the values stored in calibration files keep their meaning
+    RGB888,
+};
+
+// Per-frame details from the request metadata, carried with stills
+struct CaptureInfo
+{
+    int32_t exposure_us = 0;
+    float analogue_gain = 0;
+    // CLOCK_MONOTONIC, as libcamera's FrameMetadata::timestamp and the replay source's steady_clock
+    uint64_t timestamp_ns = 0;
+    uint32_t sequence = 0;
 };
 
 class Image
@@ -58,17 +74,80 @@ public:
     static std::unique_ptr<Image> copyFromFrameBuffer(
         const libcamera::FrameBuffer *buffer, const libcamera::StreamConfiguration& config);
 
+    static std::unique_ptr<Image> copyFromImage(const Image &source);
+    /*
+     * Copies into a buffer taken from pool, returned when the Image is
+     * destroyed. Returns nullptr without waiting when every buffer is in use.
+     */
+    static std::unique_ptr<Image> copyFromImage(const Image &source, std::shared_ptr<FramePool> pool);
+
+    // Takes ownership of data, laid out as rows of stride bytes
+    static std::unique_ptr<Image> fromBuffer(std::vector<uint8_t> data, int width, int height,
+                                             unsigned int stride, PixelColourFormat format);
+
+    // Non-owning view of a single plane in memory someone else manages, e.g. an mmapped recording
+    static std::unique_ptr<Image> fromMemory(libcamera::Span<uint8_t> data, int width, int height,
+                                             unsigned int stride, PixelColourFormat format);
+
+    /*
+     * Non-owning view of planes that are mapped (and later unmapped) by
+     * someone else, e.g. FrameBufferCache.
+     */
+    static std::unique_ptr<Image> fromPlanes(
+        const std::vector<libcamera::Span<uint8_t>> &planes, const libcamera::StreamConfiguration& config);
+
     ~Image();
 
     unsigned int numPlanes() const;
+    int width() const;
+    int height() const;
+    unsigned int stride() const;
+    PixelColourFormat format() const;
+    bool isBayer() const;
+    const CaptureInfo &captureInfo() const;
+    void setCaptureInfo(const CaptureInfo &info);
 
     libcamera::Span<uint8_t> data(unsigned int plane);
     libcamera::Span<const uint8_t> data(unsigned int plane) const;
+    size_t pixelCount() const;
     std::vector<uint8_t> dataAsRGB565();
     std::vector<uint8_t> dataAsRGB888();
     std::vector<uint8_t> dataAsBGR888();
     std::vector<uint8_t> dataAsXXR888();
+    std::vector<uint8_t> dataAsBGR565();
+    std::vector<uint8_t> dataAsXXR565();
+
+    /*
+     * Convert into a caller-owned buffer instead of allocating a new
+     * vector. Returns the number of bytes written, which is 0 when the
+     * pixel format is not supported by the conversion.
+     */
+    size_t dataAsRGB565(libcamera::Span<uint8_t> output);
+    size_t dataAsRGB888(libcamera::Span<uint8_t> output);
+    size_t dataAsBGR888(libcamera::Span<uint8_t> output);
+    size_t dataAsXXR888(libcamera::Span<uint8_t> output);
+    // 16 bit counterparts of BGR888 and XXR888 for panels in RGB565 mode
+    size_t dataAsBGR565(libcamera::Span<uint8_t> output);
+    size_t dataAsXXR565(libcamera::Span<uint8_t> output);
+    /*
+     * Scales to width x height and converts to the panel format in one
+     * pass, for previewing from a stream that isn't the panel's size.
+     * Returns the number of bytes written, 0 for unsupported formats or
+     * a short output buffer.
+     */
+    size_t resampleInto(libcamera::Span<uint8_t> output, int width, int height,
+                        PanelFormat format, ResampleFilter filter);
+    /*
+     * What the viewfinder draws: converted straight to the panel format
+     * when the image is already width x height, resampled otherwise.
+     * Returns the number of bytes written, 0 when unsupported.
+     */
+    size_t dataAsPanel(libcamera::Span<uint8_t> output, int width, int height,
+                       PanelFormat format, ResampleFilter filter);
+    // JPEG for RGB images, DNG for Bayer ones
     void writeToFile(std::string filename);
+    // Writes the planes unconverted, one write per plane
+    bool writeRawToFile(std::string filename);
 
 private:
     LIBCAMERA_DISABLE_COPY(Image)
@@ -78,10 +157,18 @@ private:
 
     Image();
 
+    // 4 for XRGB8888, 3 for RGB888, 2 for YUYV, 0 otherwise
+    unsigned int sourceBytesPerPixel() const;
+    ConvertKernel kernelFor(ConvertKernel xrgb8888, ConvertKernel rgb888, ConvertKernel yuyv) const;
+    size_t convertRows(libcamera::Span<uint8_t> output, size_t bytesPerPixel, ConvertKernel kernel) const;
+
     std::vector<libcamera::Span<uint8_t>> maps_;
     std::vector<libcamera::Span<uint8_t>> planes_;
     std::vector<std::vector<uint8_t>> buffers_;
+    std::shared_ptr<FramePool> m_pool;
+    uint8_t *m_pool_buffer = nullptr;
     PixelColourFormat m_format;
+    CaptureInfo m_capture_info;
 };
 
 namespace libcamera
@@ -0,0 +1,265 @@
+#include <cmath>
+#include <iostream>
+#include <string.h>
+#include "image_stacker.hpp"
+#include "parallel.hpp"
+#include "simd.hpp"
+
+static void accumulate_u8_scalar(const uint8_t *src, uint32_t *sum, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        sum[i] += src[i];
+}
+
+static void accumulate_u16_scalar(const uint16_t *src, uint32_t *sum, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        sum[i] += src[i];
+}
+
+#if HAVE_NEON
+
+static void accumulate_u8(const uint8_t *src, uint32_t *sum, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16_t in = vld1q_u8(src + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(in));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(in));
+        vst1q_u32(sum + i, vaddw_u16(vld1q_u32(sum + i), vget_low_u16(lo)));
+        vst1q_u32(sum + i + 4, vaddw_u16(vld1q_u32(sum + i + 4), vget_high_u16(lo)));
+        vst1q_u32(sum + i + 8, vaddw_u16(vld1q_u32(sum + i + 8), vget_low_u16(hi)));
+        vst1q_u32(sum + i + 12, vaddw_u16(vld1q_u32(sum + i + 12), vget_high_u16(hi)));
+    }
+    accumulate_u8_scalar(src + i, sum + i, count - i);
+}
+
+static void accumulate_u16(const uint16_t *src, uint32_t *sum, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t in = vld1q_u16(src + i);
+        vst1q_u32(sum + i, vaddw_u16(vld1q_u32(sum + i), vget_low_u16(in)));
+        vst1q_u32(sum + i + 4, vaddw_u16(vld1q_u32(sum + i + 4), vget_high_u16(in)));
+    }
+    accumulate_u16_scalar(src + i, sum + i, count - i);
+}
+
+#elif HAVE_SSE2
+
+static inline void sse2_accumulate(uint32_t *sum, __m128i value)
+{
+    __m128i *p = (__m128i *)sum;
+    _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), value));
+}
+
+static void accumulate_u8(const uint8_t *src, uint32_t *sum, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(in, zero);
+        __m128i hi = _mm_unpackhi_epi8(in, zero);
+        sse2_accumulate(sum + i, _mm_unpacklo_epi16(lo, zero));
+        sse2_accumulate(sum + i + 4, _mm_unpackhi_epi16(lo, zero));
+        sse2_accumulate(sum + i + 8, _mm_unpacklo_epi16(hi, zero));
+        sse2_accumulate(sum + i + 12, _mm_unpackhi_epi16(hi, zero));
+    }
+    accumulate_u8_scalar(src + i, sum + i, count - i);
+}
+
+static void accumulate_u16(const uint16_t *src, uint32_t *sum, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        sse2_accumulate(sum + i, _mm_unpacklo_epi16(in, zero));
+        sse2_accumulate(sum + i + 4, _mm_unpackhi_epi16(in, zero));
+    }
+    accumulate_u16_scalar(src + i, sum + i, count - i);
+}
+
+#else
+
+static void accumulate_u8(const uint8_t *src, uint32_t *sum, size_t count)
+{
+    accumulate_u8_scalar(src, sum, count);
+}
+
+static void accumulate_u16(const uint16_t *src, uint32_t *sum, size_t count)
+{
+    accumulate_u16_scalar(src, sum, count);
+}
+
+#endif
+
+ImageStacker::ImageStacker(const StackOptions &options)
+    : m_options(options)
+{
+    m_options.ring_size = std::max(m_options.ring_size, 1u);
+}
+
+unsigned int ImageStacker::frameCount() const
+{
+    return m_frames;
+}
+
+const StackOptions &ImageStacker::options() const
+{
+    return m_options;
+}
+
+size_t ImageStacker::frameBytes() const
+{
+    return m_row_samples * m_sample_size * m_height;
+}
+
+void ImageStacker::storeSample(uint8_t *row, size_t index, uint32_t value) const
+{
+    if (m_sample_size == 2)
+    {
+        uint16_t sample = value;
+        memcpy(row + index * 2, &sample, 2);
+    }
+    else
+    {
+        row[index] = value;
+    }
+}
+
+uint32_t ImageStacker::loadSample(const uint8_t *row, size_t index) const
+{
+    if (m_sample_size == 2)
+    {
+        uint16_t sample;
+        memcpy(&sample, row + index * 2, 2);
+        return sample;
+    }
+    return row[index];
+}
+
+bool ImageStacker::add(const Image &image)
+{
+    if (m_frames == 0)
+    {
+        m_width = image.width();
+        m_height = image.height();
+        m_format = image.format();
+        m_capture_info = image.captureInfo();
+        m_sample_size = image.isBayer() ? 2 : 1;
+        m_row_samples = image.isBayer() ? m_width : m_width * 3;
+        if (m_options.mode == StackMode::Mean)
+            m_sum.assign(m_row_samples * m_height, 0);
+        else
+            m_ring.assign(frameBytes() * m_options.ring_size, 0);
+    }
+    else if (image.width() != m_width || image.height() != m_height || image.format() != m_format)
+    {
+        std::cerr << "Frame is " << image.width() << "x" << image.height()
+                  << ", not stacking it onto " << m_width << "x" << m_height << std::endl;
+        return false;
+    }
+
+    libcamera::Span<const uint8_t> plane = image.data(0);
+    const unsigned int stride = image.stride();
+    if (plane.size() < (size_t)stride * (m_height - 1) + m_row_samples * m_sample_size)
+    {
+        std::cerr << "Frame plane is too small to stack" << std::endl;
+        return false;
+    }
+
+    if (m_options.mode == StackMode::Mean)
+    {
+        parallel_for(m_height, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++)
+            {
+                const uint8_t *src = plane.data() + y * stride;
+                uint32_t *sum = m_sum.data() + y * m_row_samples;
+                if (m_sample_size == 2)
+                    accumulate_u16((const uint16_t *)src, sum, m_row_samples);
+                else
+                    accumulate_u8(src, sum, m_row_samples);
+            }
+        });
+    }
+    else
+    {
+        const size_t rowBytes = m_row_samples * m_sample_size;
+        uint8_t *slot = m_ring.data() + frameBytes() * (m_frames % m_options.ring_size);
+        parallel_for(m_height, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++)
+                memcpy(slot + y * rowBytes, plane.data() + y * stride, rowBytes);
+        });
+    }
+    m_frames++;
+    return true;
+}
+
+std::unique_ptr<Image> ImageStacker::result() const
+{
+    if (m_frames == 0)
+        return nullptr;
+
+    const size_t rowBytes = m_row_samples * m_sample_size;
+    std::vector<uint8_t> data(frameBytes());
+
+    if (m_options.mode == StackMode::Mean)
+    {
+        const uint32_t frames = m_frames;
+        parallel_for(m_height, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++)
+            {
+                const uint32_t *sum = m_sum.data() + y * m_row_samples;
+                uint8_t *out = data.data() + y * rowBytes;
+                for (size_t i = 0; i < m_row_samples; i++)
+                    storeSample(out, i, (sum[i] + frames / 2) / frames);
+            }
+        });
+    }
+    else
+    {
+        const unsigned int frames = std::min(m_frames, m_options.ring_size);
+        const float sigma = m_options.sigma;
+        parallel_for(m_height, [&](size_t begin, size_t end) {
+            std::vector<uint32_t> values(frames);
+            for (size_t y = begin; y < end; y++)
+            {
+                uint8_t *out = data.data() + y * rowBytes;
+                for (size_t i = 0; i < m_row_samples; i++)
+                {
+                    double sum = 0, squares = 0;
+                    for (unsigned int f = 0; f < frames; f++)
+                    {
+                        values[f] = loadSample(m_ring.data() + frameBytes() * f + y * rowBytes, i);
+                        sum += values[f];
+                        squares += (double)values[f] * values[f];
+                    }
+                    double mean = sum / frames;
+                    double limit = sigma * std::sqrt(std::max(squares / frames - mean * mean, 0.0));
+
+                    double kept = 0;
+                    unsigned int count = 0;
+                    for (unsigned int f = 0; f < frames; f++)
+                    {
+                        if (std::fabs(values[f] - mean) <= limit)
+                        {
+                            kept += values[f];
+                            count++;
+                        }
+                    }
+                    storeSample(out, i, (uint32_t)std::lround(count ? kept / count : mean));
+                }
+            }
+        });
+    }
+
+    std::unique_ptr<Image> image = Image::fromBuffer(std::move(data), m_width, m_height, rowBytes, m_format);
+    image->setCaptureInfo(m_capture_info);
+    return image;
+}
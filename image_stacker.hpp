@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "image.h"
+
+enum class StackMode {
+    Mean,      // running 32 bit sum of every frame added
+    SigmaClip, // sigma clipped mean over the last ring_size frames
+};
+
+struct StackOptions {
+    StackMode mode = StackMode::Mean;
+    unsigned int ring_size = 8;
+    float sigma = 3.0f;
+    unsigned int snapshot_interval = 10; // frames between snapshots, 0 for none
+};
+
+/*
+ * Combines a burst of stills of the same target into one image. Frames
+ * must all have the first frame's size and format; Bayer frames are
+ * stacked as 16 bit samples, everything else as RGB888 bytes. Adding a
+ * frame is vectorised and split across cores by rows.
+ */
+class ImageStacker {
+    StackOptions m_options;
+    int m_width = 0;
+    int m_height = 0;
+    PixelColourFormat m_format;
+    CaptureInfo m_capture_info;
+    size_t m_row_samples = 0;
+    size_t m_sample_size = 0;
+    unsigned int m_frames = 0;
+    std::vector<uint32_t> m_sum;
+    std::vector<uint8_t> m_ring;
+
+    public:
+        ImageStacker(const StackOptions &options);
+        bool add(const Image &image);
+        unsigned int frameCount() const;
+        const StackOptions &options() const;
+        std::unique_ptr<Image> result() const;
+
+    private:
+        size_t frameBytes() const;
+        void storeSample(uint8_t *row, size_t index, uint32_t value) const;
+        uint32_t loadSample(const uint8_t *row, size_t index) const;
+};
@@ -1,20 +1,139 @@
+#include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <iostream>
 #include <mutex>
-#include <queue>
 #include <sstream>
 #include <iomanip>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
 #include "image_writer.hpp"
+#include "fits_writer.hpp"
+#include "calibration.hpp"
+#include "hot_pixels.hpp"
+#include "metrics.hpp"
+
+struct QueuedImage
+{
+    std::unique_ptr<Image> image;
+    int frame_number;
+};
 
 static std::mutex queue_lock;
 static std::condition_variable cond_var;
-static std::queue<std::unique_ptr<Image>> queue;
-static std::unique_ptr<std::thread> worker;
+static std::condition_variable space_available;
+static std::deque<QueuedImage> queue;
+static std::vector<std::thread> workers;
+static ImageWriterOptions writer_options;
+static bool stopping;
 static int frame_number;
+static std::mutex stack_lock;
+static std::unique_ptr<ImageStacker> stacker;
+static std::unique_ptr<Calibration> calibration;
+static std::unique_ptr<HotPixelMap> hot_pixels;
+
+static std::string frame_filename(const char *prefix, int number, const char *extension)
+{
+    std::stringstream ss;
+    ss << "stills/" << prefix << std::setw(6) << std::setfill('0') << number << "." << extension;
+    return ss.str();
+}
+
+static void count_bytes_written(const std::string &filename)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) == 0)
+        metrics().bytes_written.add(info.st_size);
+}
+
+static void write_image(Image &image, const char *prefix, int number)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string filename;
+    if (writer_options.format == OutputFormat::Fits)
+    {
+        filename = frame_filename(prefix, number, "fits");
+        write_fits(filename, image);
+    }
+    else
+    {
+        filename = frame_filename(prefix, number, image.isBayer() ? "dng" : "jpg");
+        image.writeToFile(filename);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    metrics().encode_us.record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    count_bytes_written(filename);
+}
+
+static void stack_image(const Image &image)
+{
+    std::unique_ptr<Image> snapshot;
+    unsigned int frames;
+    {
+        std::unique_lock lock(stack_lock);
+        if (!stacker->add(image))
+            return;
+        frames = stacker->frameCount();
+        unsigned int interval = writer_options.stacking.snapshot_interval;
+        if (interval && frames % interval == 0)
+            snapshot = stacker->result();
+    }
+    if (snapshot)
+        write_image(*snapshot, "stack", frames);
+}
+
+static void store_master(const Image &master, unsigned int frames)
+{
+    const std::string &filename = writer_options.calibration_file;
+    if (!calibration->matches(master) && !calibration->create(filename, master))
+        return;
+
+    bool dark = writer_options.calibration == CalibrationMode::CaptureDark;
+    if (dark ? calibration->storeDark(master) : calibration->storeFlat(master))
+        std::cout << "Stored master " << (dark ? "dark" : "flat") << " from " << frames
+                  << " frames in " << filename << std::endl;
+
+    if (dark && writer_options.hot_pixels)
+    {
+        HotPixelMap map = HotPixelMap::detect(master);
+        if (map.save(writer_options.hot_pixel_file))
+            std::cout << "Mapped " << map.size() << " hot pixels into "
+                      << writer_options.hot_pixel_file << std::endl;
+    }
+}
 
 void enqueue_image(std::unique_ptr<Image> image)
 {
     std::unique_lock lock(queue_lock);
-    queue.push(std::move(image));
+    // numbered on arrival so the filenames stay in frame order whichever worker finishes first
+    int number = frame_number++;
+    if (queue.size() >= writer_options.max_queue)
+    {
+        switch (writer_options.policy)
+        {
+            case QueuePolicy::Block:
+                space_available.wait(lock, [] { return queue.size() < writer_options.max_queue; });
+                break;
+            case QueuePolicy::DropOldest:
+                std::cerr << "Image queue full, dropping frame " << queue.front().frame_number << std::endl;
+                queue.pop_front();
+                metrics().stills_dropped.add();
+                break;
+            case QueuePolicy::Raw:
+            {
+                lock.unlock();
+                metrics().stills_dropped.add();
+                std::string filename = frame_filename("frame", number, "raw");
+                if (image->writeRawToFile(filename))
+                    count_bytes_written(filename);
+                return;
+            }
+        }
+    }
+    queue.push_back({std::move(image), number});
+    metrics().writer_queue_depth.set(queue.size());
 
     lock.unlock();
     cond_var.notify_one();
@@ -25,31 +144,97 @@ static void process_images()
     std::unique_lock lock(queue_lock);
     while (true)
     {
-        cond_var.wait(lock);
-        if (queue.empty()) // we've been notified with nothing in the queue - that means we're shutting down
+        cond_var.wait(lock, [] { return stopping || !queue.empty(); });
+        if (queue.empty()) // only once we're shutting down and everything has been written
             return;
-        while (!queue.empty())
-        {
-            std::unique_ptr<Image> &image = queue.front();
-            // figure out the filename
-            std::stringstream ss;
-            ss << "stills/frame" << std::setw(6) << std::setfill('0') << frame_number << ".jpg";
-            image->writeToFile(ss.str());
-            frame_number++;
-            queue.pop();
-        }
+
+        QueuedImage item = std::move(queue.front());
+        queue.pop_front();
+        metrics().writer_queue_depth.set(queue.size());
+        lock.unlock();
+        space_available.notify_one();
+
+        if (writer_options.calibration == CalibrationMode::Apply)
+            calibration->apply(*item.image);
+        if (hot_pixels)
+            hot_pixels->correct(*item.image);
+        if (stacker)
+            stack_image(*item.image);
+        else
+            write_image(*item.image, "frame", item.frame_number);
+        item.image.reset();
+
+        lock.lock();
     }
 }
 
-void start_image_processing()
+void start_image_processing(const ImageWriterOptions &options)
 {
+    writer_options = options;
+    stopping = false;
+    if (options.calibration != CalibrationMode::Off)
+    {
+        calibration = std::make_unique<Calibration>();
+        if (!calibration->open(options.calibration_file) && options.calibration == CalibrationMode::Apply)
+        {
+            std::cerr << "No calibration masters in " << options.calibration_file
+                      << ", stills will be uncalibrated" << std::endl;
+            writer_options.calibration = CalibrationMode::Off;
+        }
+    }
+
+    // the dark frames are what the hot pixels are found in, so leave them alone
+    if (options.hot_pixels && options.calibration != CalibrationMode::CaptureDark)
+    {
+        hot_pixels = std::make_unique<HotPixelMap>();
+        if (!hot_pixels->load(options.hot_pixel_file))
+        {
+            std::cerr << "No hot pixel map in " << options.hot_pixel_file << std::endl;
+            hot_pixels.reset();
+        }
+    }
+
+    if (options.calibration == CalibrationMode::CaptureDark || options.calibration == CalibrationMode::CaptureFlat)
+    {
+        // masters are the plain mean of the burst, written instead of the frames
+        StackOptions masterOptions;
+        masterOptions.mode = StackMode::Mean;
+        masterOptions.snapshot_interval = 0;
+        stacker = std::make_unique<ImageStacker>(masterOptions);
+    }
+    else if (options.stack)
+    {
+        stacker = std::make_unique<ImageStacker>(options.stacking);
+    }
     // need to initialise frame_number to a reasonable value.
-    worker = std::make_unique<std::thread>(process_images);
+    for (unsigned int i = 0; i < std::max(options.threads, 1u); i++)
+        workers.emplace_back(process_images);
 }
 
 void stop_image_processing()
 {
-    cond_var.notify_one();
-    worker->join();
-    worker.reset();
+    {
+        std::unique_lock lock(queue_lock);
+        stopping = true;
+    }
+    cond_var.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+
+    if (stacker)
+    {
+        if (stacker->frameCount())
+        {
+            std::unique_ptr<Image> stacked = stacker->result();
+            if (writer_options.calibration == CalibrationMode::CaptureDark ||
+                writer_options.calibration == CalibrationMode::CaptureFlat)
+                store_master(*stacked, stacker->frameCount());
+            else
+                write_image(*stacked, "stacked", stacker->frameCount());
+        }
+        stacker.reset();
+    }
+    calibration.reset();
+    hot_pixels.reset();
 }
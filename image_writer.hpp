@@ -1,10 +1,46 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include "image.h"
+#include "image_stacker.hpp"
+
+// What enqueue_image does once the queue holds max_queue images
+enum class QueuePolicy {
+    Block,      // wait for a worker to take an image, stalling the caller
+    DropOldest, // discard the oldest queued image
+    Raw,        // skip encoding and write the new image's planes as-is
+};
+
+enum class OutputFormat {
+    Native, // JPEG for RGB stills, DNG for raw Bayer ones
+    Fits,
+};
+
+enum class CalibrationMode {
+    Off,
+    Apply,       // calibrate each still with the stored masters
+    CaptureDark, // average the stills into a new master dark
+    CaptureFlat, // average the stills into a new master flat
+};
+
+struct ImageWriterOptions {
+    unsigned int threads = 1;
+    size_t max_queue = 4;
+    QueuePolicy policy = QueuePolicy::Block;
+    OutputFormat format = OutputFormat::Native;
+    // stack every still into one image instead of writing each frame
+    bool stack = false;
+    StackOptions stacking;
+    CalibrationMode calibration = CalibrationMode::Off;
+    std::string calibration_file = "calibration.masters";
+    // correct stuck pixels, mapping them whenever a master dark is captured
+    bool hot_pixels = false;
+    std::string hot_pixel_file = "hotpixels.map";
+};
 
 void enqueue_image(std::unique_ptr<Image> image);
 
-void start_image_processing();
+void start_image_processing(const ImageWriterOptions &options = ImageWriterOptions());
 
-void stop_image_processing();
\ No newline at end of file
+void stop_image_processing();
@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+#include "jpeg_writer.hpp"
+#include "parallel.hpp"
+
+// 4:2:0, so each MCU is 16x16 pixels: four luma blocks and one of each chroma
+#define MCU_SIZE 16
+// restart intervals are counted in MCUs and stored in 16 bits
+#define MAX_RESTART_INTERVAL 65535
+
+#define MARKER_SOI 0xD8
+#define MARKER_EOI 0xD9
+#define MARKER_SOF0 0xC0
+#define MARKER_DHT 0xC4
+#define MARKER_DQT 0xDB
+#define MARKER_DRI 0xDD
+#define MARKER_SOS 0xDA
+#define MARKER_APP0 0xE0
+#define MARKER_RST0 0xD0
+
+// Natural order index of each coefficient in zigzag order
+static const uint8_t ZIGZAG[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// The example tables from Annex K of the JPEG spec, in natural order
+static const uint8_t LUMA_QUANT[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99,
+};
+
+static const uint8_t CHROMA_QUANT[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+// Code counts for lengths 1-16, then the symbols in code order
+static const uint8_t LUMA_DC_BITS[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t LUMA_DC_VALUES[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t CHROMA_DC_BITS[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t CHROMA_DC_VALUES[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t LUMA_AC_BITS[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t LUMA_AC_VALUES[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+static const uint8_t CHROMA_AC_BITS[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t CHROMA_AC_VALUES[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+struct HuffmanTable
+{
+    uint16_t codes[256] = {};
+    uint8_t lengths[256] = {};
+};
+
+// Canonical codes from the code counts, Annex C
+static HuffmanTable build_huffman(const uint8_t bits[16], const uint8_t *values)
+{
+    HuffmanTable table;
+    uint16_t code = 0;
+    size_t k = 0;
+    for (int length = 1; length <= 16; length++)
+    {
+        for (int i = 0; i < bits[length - 1]; i++, k++)
+        {
+            table.codes[values[k]] = code++;
+            table.lengths[values[k]] = length;
+        }
+        code <<= 1;
+    }
+    return table;
+}
+
+// Per quality tables, shared read only by the band encoders
+struct EncoderTables
+{
+    uint8_t quant[2][64];   // zigzag order, as written to DQT
+    float divisors[2][64];  // natural order, folding in the AAN output scaling
+    HuffmanTable dc[2];
+    HuffmanTable ac[2];
+
+    EncoderTables(int quality)
+    {
+        quality = std::clamp(quality, 1, 100);
+        int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+
+        static const float aan[8] = {
+            1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+            1.0f, 0.785694958f, 0.541196100f, 0.275899379f,
+        };
+        const uint8_t *base[2] = {LUMA_QUANT, CHROMA_QUANT};
+        for (int t = 0; t < 2; t++)
+        {
+            for (int i = 0; i < 64; i++)
+            {
+                int q = std::clamp((base[t][ZIGZAG[i]] * scale + 50) / 100, 1, 255);
+                quant[t][i] = q;
+                int natural = ZIGZAG[i];
+                divisors[t][natural] = 1.0f / (q * aan[natural / 8] * aan[natural % 8] * 8.0f);
+            }
+        }
+
+        dc[0] = build_huffman(LUMA_DC_BITS, LUMA_DC_VALUES);
+        ac[0] = build_huffman(LUMA_AC_BITS, LUMA_AC_VALUES);
+        dc[1] = build_huffman(CHROMA_DC_BITS, CHROMA_DC_VALUES);
+        ac[1] = build_huffman(CHROMA_AC_BITS, CHROMA_AC_VALUES);
+    }
+};
+
+// Accumulates entropy coded bits, stuffing a zero after every 0xFF
+class BitWriter {
+    std::vector<uint8_t> &m_out;
+    uint32_t m_bits = 0;
+    int m_count = 0;
+
+    public:
+        BitWriter(std::vector<uint8_t> &out) : m_out(out) {}
+
+        void put(uint32_t value, int length)
+        {
+            m_bits = (m_bits << length) | (value & ((1u << length) - 1));
+            m_count += length;
+            while (m_count >= 8)
+            {
+                uint8_t byte = m_bits >> (m_count - 8);
+                m_out.push_back(byte);
+                if (byte == 0xFF)
+                    m_out.push_back(0);
+                m_count -= 8;
+            }
+        }
+
+        // Pads the last byte with 1 bits, as needed before a marker
+        void flush()
+        {
+            if (m_count > 0)
+                put(0x7F, 8 - m_count);
+        }
+};
+
+// Floating point AAN forward DCT, in place, output scaled as the divisors expect
+static void forward_dct(float *block)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        // rows first, then columns
+        const int step = pass == 0 ? 1 : 8;
+        const int next = pass == 0 ? 8 : 1;
+        for (int i = 0; i < 8; i++)
+        {
+            float *d = block + i * next;
+            float tmp0 = d[0] + d[7 * step], tmp7 = d[0] - d[7 * step];
+            float tmp1 = d[step] + d[6 * step], tmp6 = d[step] - d[6 * step];
+            float tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+            float tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+            // even part
+            float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+            float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+            d[0] = tmp10 + tmp11;
+            d[4 * step] = tmp10 - tmp11;
+            float z1 = (tmp12 + tmp13) * 0.707106781f;
+            d[2 * step] = tmp13 + z1;
+            d[6 * step] = tmp13 - z1;
+
+            // odd part
+            tmp10 = tmp4 + tmp5;
+            tmp11 = tmp5 + tmp6;
+            tmp12 = tmp6 + tmp7;
+            float z5 = (tmp10 - tmp12) * 0.382683433f;
+            float z2 = 0.541196100f * tmp10 + z5;
+            float z4 = 1.306562965f * tmp12 + z5;
+            float z3 = tmp11 * 0.707106781f;
+            float z11 = tmp7 + z3, z13 = tmp7 - z3;
+            d[5 * step] = z13 + z2;
+            d[3 * step] = z13 - z2;
+            d[step] = z11 + z4;
+            d[7 * step] = z11 - z4;
+        }
+    }
+}
+
+static inline int magnitude_bits(int value)
+{
+    unsigned int magnitude = value < 0 ? -value : value;
+    int bits = 0;
+    while (magnitude)
+    {
+        bits++;
+        magnitude >>= 1;
+    }
+    return bits;
+}
+
+static void encode_block(BitWriter &writer, float *block, const EncoderTables &tables, int table, int &dcPredictor)
+{
+    forward_dct(block);
+    int coefficients[64];
+    for (int i = 0; i < 64; i++)
+    {
+        int natural = ZIGZAG[i];
+        float value = block[natural] * tables.divisors[table][natural];
+        coefficients[i] = (int)(value < 0 ? value - 0.5f : value + 0.5f);
+    }
+
+    const HuffmanTable &dc = tables.dc[table];
+    const HuffmanTable &ac = tables.ac[table];
+
+    int diff = coefficients[0] - dcPredictor;
+    dcPredictor = coefficients[0];
+    int bits = magnitude_bits(diff);
+    writer.put(dc.codes[bits], dc.lengths[bits]);
+    if (bits)
+        writer.put(diff < 0 ? diff - 1 : diff, bits);
+
+    int run = 0;
+    for (int i = 1; i < 64; i++)
+    {
+        int value = coefficients[i];
+        if (value == 0)
+        {
+            run++;
+            continue;
+        }
+        while (run >= 16)
+        {
+            writer.put(ac.codes[0xF0], ac.lengths[0xF0]); // sixteen zeros
+            run -= 16;
+        }
+        bits = magnitude_bits(value);
+        uint8_t symbol = (run << 4) | bits;
+        writer.put(ac.codes[symbol], ac.lengths[symbol]);
+        writer.put(value < 0 ? value - 1 : value, bits);
+        run = 0;
+    }
+    if (run)
+        writer.put(ac.codes[0x00], ac.lengths[0x00]); // end of block
+}
+
+struct SourceImage
+{
+    const uint8_t *data;
+    unsigned int width;
+    unsigned int height;
+    unsigned int stride;
+    int red;  // byte offset of red in each pixel, blue is at 2 - red
+};
+
+// Colour converts and codes MCU rows [first, last) as one restart interval
+static void encode_band(const SourceImage &source, const EncoderTables &tables,
+                        unsigned int first, unsigned int last, std::vector<uint8_t> &out)
+{
+    BitWriter writer(out);
+    int predictors[3] = {0, 0, 0};
+    const unsigned int mcuColumns = (source.width + MCU_SIZE - 1) / MCU_SIZE;
+    float y[MCU_SIZE * MCU_SIZE], cb[64], cr[64];
+
+    for (unsigned int mcuRow = first; mcuRow < last; mcuRow++)
+    {
+        const uint8_t *rows[MCU_SIZE];
+        for (int r = 0; r < MCU_SIZE; r++)
+        {
+            // repeat the last row to fill out the bottom MCUs
+            unsigned int sourceRow = std::min(mcuRow * MCU_SIZE + r, source.height - 1);
+            rows[r] = source.data + (size_t)sourceRow * source.stride;
+        }
+
+        for (unsigned int mcu = 0; mcu < mcuColumns; mcu++)
+        {
+            std::fill(cb, cb + 64, 0.0f);
+            std::fill(cr, cr + 64, 0.0f);
+            for (int r = 0; r < MCU_SIZE; r++)
+            {
+                for (int c = 0; c < MCU_SIZE; c++)
+                {
+                    // and the last column for the right hand ones
+                    unsigned int x = std::min(mcu * MCU_SIZE + c, source.width - 1);
+                    const uint8_t *pixel = rows[r] + x * 3;
+                    float red = pixel[source.red], green = pixel[1], blue = pixel[2 - source.red];
+
+                    y[r * MCU_SIZE + c] = 0.299f * red + 0.587f * green + 0.114f * blue - 128.0f;
+                    int chroma = (r / 2) * 8 + c / 2;
+                    cb[chroma] += -0.168736f * red - 0.331264f * green + 0.5f * blue;
+                    cr[chroma] += 0.5f * red - 0.418688f * green - 0.081312f * blue;
+                }
+            }
+
+            float block[64];
+            for (int b = 0; b < 4; b++)
+            {
+                const float *origin = y + (b / 2) * 8 * MCU_SIZE + (b % 2) * 8;
+                for (int r = 0; r < 8; r++)
+                    memcpy(block + r * 8, origin + r * MCU_SIZE, 8 * sizeof(float));
+                encode_block(writer, block, tables, 0, predictors[0]);
+            }
+            for (int i = 0; i < 64; i++)
+                block[i] = cb[i] * 0.25f;
+            encode_block(writer, block, tables, 1, predictors[1]);
+            for (int i = 0; i < 64; i++)
+                block[i] = cr[i] * 0.25f;
+            encode_block(writer, block, tables, 1, predictors[2]);
+        }
+    }
+    writer.flush();
+}
+
+static void put_marker(std::vector<uint8_t> &out, uint8_t marker)
+{
+    out.push_back(0xFF);
+    out.push_back(marker);
+}
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t value)
+{
+    out.push_back(value >> 8);
+    out.push_back(value & 0xFF);
+}
+
+static void put_huffman(std::vector<uint8_t> &out, uint8_t tableClassAndId, const uint8_t bits[16], const uint8_t *values)
+{
+    size_t count = 0;
+    for (int i = 0; i < 16; i++)
+        count += bits[i];
+    out.push_back(tableClassAndId);
+    out.insert(out.end(), bits, bits + 16);
+    out.insert(out.end(), values, values + count);
+}
+
+static std::vector<uint8_t> build_header(const EncoderTables &tables, unsigned int width, unsigned int height,
+                                         unsigned int restartInterval)
+{
+    std::vector<uint8_t> out;
+    put_marker(out, MARKER_SOI);
+
+    put_marker(out, MARKER_APP0);
+    const uint8_t jfif[] = {0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    out.insert(out.end(), jfif, jfif + sizeof(jfif));
+
+    put_marker(out, MARKER_DQT);
+    put_u16(out, 2 + 2 * 65);
+    for (int t = 0; t < 2; t++)
+    {
+        out.push_back(t);
+        out.insert(out.end(), tables.quant[t], tables.quant[t] + 64);
+    }
+
+    put_marker(out, MARKER_SOF0);
+    put_u16(out, 8 + 3 * 3);
+    out.push_back(8);
+    put_u16(out, height);
+    put_u16(out, width);
+    out.push_back(3);
+    const uint8_t components[] = {1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1};
+    out.insert(out.end(), components, components + sizeof(components));
+
+    put_marker(out, MARKER_DHT);
+    put_u16(out, 2 + 4 * 17 + 12 + 162 + 12 + 162);
+    put_huffman(out, 0x00, LUMA_DC_BITS, LUMA_DC_VALUES);
+    put_huffman(out, 0x10, LUMA_AC_BITS, LUMA_AC_VALUES);
+    put_huffman(out, 0x01, CHROMA_DC_BITS, CHROMA_DC_VALUES);
+    put_huffman(out, 0x11, CHROMA_AC_BITS, CHROMA_AC_VALUES);
+
+    put_marker(out, MARKER_DRI);
+    put_u16(out, 4);
+    put_u16(out, restartInterval);
+
+    put_marker(out, MARKER_SOS);
+    put_u16(out, 6 + 3 * 2);
+    out.push_back(3);
+    const uint8_t scan[] = {1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0};
+    out.insert(out.end(), scan, scan + sizeof(scan));
+    return out;
+}
+
+bool write_jpeg(const std::string &filename, libcamera::Span<const uint8_t> data,
+                unsigned int width, unsigned int height, unsigned int stride,
+                JpegPixelOrder order, int quality)
+{
+    if (width == 0 || height == 0 || width > 65535 || height > 65535 ||
+        data.size() < (size_t)stride * (height - 1) + width * 3)
+    {
+        std::cerr << "Not writing " << filename << ", bad image dimensions" << std::endl;
+        return false;
+    }
+
+    const EncoderTables tables(quality);
+    const SourceImage source = {data.data(), width, height, stride, order == JpegPixelOrder::RGB ? 0 : 2};
+
+    // a couple of bands per core, each a whole number of MCU rows within the restart interval limit
+    const unsigned int mcuColumns = (width + MCU_SIZE - 1) / MCU_SIZE;
+    const unsigned int mcuRows = (height + MCU_SIZE - 1) / MCU_SIZE;
+    unsigned int rowsPerBand = (mcuRows + parallel_threads() * 2 - 1) / (parallel_threads() * 2);
+    rowsPerBand = std::clamp(rowsPerBand, 1u, MAX_RESTART_INTERVAL / mcuColumns);
+    const unsigned int bands = (mcuRows + rowsPerBand - 1) / rowsPerBand;
+
+    std::vector<std::vector<uint8_t>> segments(bands);
+    parallel_for(bands, [&](size_t begin, size_t end) {
+        for (size_t band = begin; band < end; band++)
+        {
+            unsigned int first = band * rowsPerBand;
+            encode_band(source, tables, first, std::min(first + rowsPerBand, mcuRows), segments[band]);
+        }
+    });
+
+    std::vector<uint8_t> header = build_header(tables, width, height, rowsPerBand * mcuColumns);
+    // RST0-RST7 cycle between the segments, EOI after the last
+    uint8_t markers[8][2];
+    for (int i = 0; i < 8; i++)
+    {
+        markers[i][0] = 0xFF;
+        markers[i][1] = MARKER_RST0 + i;
+    }
+    uint8_t trailer[2] = {0xFF, MARKER_EOI};
+
+    std::vector<struct iovec> iov;
+    iov.push_back({header.data(), header.size()});
+    for (unsigned int band = 0; band < bands; band++)
+    {
+        if (band > 0)
+            iov.push_back({markers[(band - 1) % 8], 2});
+        iov.push_back({segments[band].data(), segments[band].size()});
+    }
+    iov.push_back({trailer, 2});
+
+    size_t total = 0;
+    for (const struct iovec &part : iov)
+        total += part.iov_len;
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    // writev can stop short, pick up where it left off
+    size_t written = 0;
+    size_t part = 0;
+    while (part < iov.size())
+    {
+        ssize_t ret = writev(fd, &iov[part], std::min<size_t>(iov.size() - part, IOV_MAX));
+        if (ret <= 0)
+            break;
+        written += ret;
+        while (part < iov.size() && (size_t)ret >= iov[part].iov_len)
+            ret -= iov[part++].iov_len;
+        if (part < iov.size())
+        {
+            iov[part].iov_base = (uint8_t *)iov[part].iov_base + ret;
+            iov[part].iov_len -= ret;
+        }
+    }
+    close(fd);
+
+    if (written != total)
+    {
+        std::cerr << "Failed to write " << filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <libcamera/base/span.h>
+
+// Byte order of the 3 byte pixels handed to write_jpeg()
+enum class JpegPixelOrder {
+    RGB,
+    BGR,
+};
+
+/*
+ * Writes 8 bit, 3 byte per pixel rows (stride bytes apart) as a baseline
+ * 4:2:0 JFIF. The image is cut into bands of whole MCU rows, one restart
+ * interval each. Every band is colour converted straight from the source
+ * rows and entropy coded on its own core, and the bands go out with
+ * RSTn markers between them in a single writev.
+ */
+bool write_jpeg(const std::string &filename, libcamera::Span<const uint8_t> data,
+                unsigned int width, unsigned int height, unsigned int stride,
+                JpegPixelOrder order, int quality);
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <mutex>
+#include <thread>
+#include "metrics.hpp"
+
+static std::thread reporter;
+static std::mutex reporter_lock;
+static std::condition_variable reporter_wake;
+static bool reporter_stopping;
+
+Metrics &metrics()
+{
+    static Metrics instance;
+    return instance;
+}
+
+static unsigned int bucket_for(uint64_t value)
+{
+    unsigned int bucket = value ? std::bit_width(value) - 1 : 0;
+    return std::min(bucket, (unsigned int)HISTOGRAM_BUCKETS - 1);
+}
+
+void Histogram::record(uint64_t value)
+{
+    m_buckets[bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+HistogramSnapshot Histogram::snapshot() const
+{
+    HistogramSnapshot snapshot;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    snapshot.count = m_count.load(std::memory_order_relaxed);
+    snapshot.sum = m_sum.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+HistogramSnapshot HistogramSnapshot::since(const HistogramSnapshot &earlier) const
+{
+    HistogramSnapshot difference;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        difference.buckets[i] = buckets[i] - earlier.buckets[i];
+    difference.count = count - earlier.count;
+    difference.sum = sum - earlier.sum;
+    return difference;
+}
+
+uint64_t HistogramSnapshot::quantile(double q) const
+{
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += buckets[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)(q * total + 0.5));
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return (2ull << i) - 1;
+    }
+    return (2ull << (HISTOGRAM_BUCKETS - 1)) - 1;
+}
+
+uint64_t HistogramSnapshot::mean() const
+{
+    return count ? sum / count : 0;
+}
+
+namespace {
+
+struct Sample
+{
+    std::chrono::steady_clock::time_point time;
+    uint64_t viewfinder_frames;
+    uint64_t camera_frames_dropped;
+    uint64_t display_frames_dropped;
+    uint64_t stills_captured;
+    uint64_t stills_dropped;
+    uint64_t bytes_written;
+    HistogramSnapshot encode_us;
+};
+
+Sample take_sample()
+{
+    Metrics &m = metrics();
+    return {std::chrono::steady_clock::now(), m.viewfinder_frames.value(), m.camera_frames_dropped.value(),
+            m.display_frames_dropped.value(), m.stills_captured.value(), m.stills_dropped.value(),
+            m.bytes_written.value(), m.encode_us.snapshot()};
+}
+
+void print_stats(std::ostream &out, const Sample &previous, const Sample &current)
+{
+    double seconds = std::chrono::duration<double>(current.time - previous.time).count();
+    if (seconds <= 0)
+        return;
+    HistogramSnapshot encode = current.encode_us.since(previous.encode_us);
+
+    out << std::fixed << std::setprecision(1)
+        << "fps " << (current.viewfinder_frames - previous.viewfinder_frames) / seconds
+        << " | dropped camera " << current.camera_frames_dropped - previous.camera_frames_dropped
+        << " display " << current.display_frames_dropped - previous.display_frames_dropped
+        << " stills " << current.stills_dropped - previous.stills_dropped
+        << " | stills " << current.stills_captured - previous.stills_captured
+        << " queue " << metrics().writer_queue_depth.value()
+        << " | encode";
+    if (encode.count)
+        out << " mean " << encode.mean() / 1000.0 << "ms p50 <" << encode.quantile(0.5) / 1000.0
+            << "ms p99 <" << encode.quantile(0.99) / 1000.0 << "ms";
+    else
+        out << " -";
+    out << " | written " << (current.bytes_written - previous.bytes_written) / seconds / 1e6 << " MB/s, "
+        << current.bytes_written / 1e6 << " MB total" << std::endl;
+}
+
+void report(unsigned int intervalSeconds, std::ostream &out)
+{
+    Sample previous = take_sample();
+    std::unique_lock lock(reporter_lock);
+    while (!reporter_wake.wait_for(lock, std::chrono::seconds(intervalSeconds), [] { return reporter_stopping; }))
+    {
+        Sample current = take_sample();
+        print_stats(out, previous, current);
+        previous = current;
+    }
+}
+
+}
+
+void start_stats_reporter(unsigned int intervalSeconds, std::ostream &out)
+{
+    if (intervalSeconds == 0 || reporter.joinable())
+        return;
+    reporter_stopping = false;
+    reporter = std::thread(report, intervalSeconds, std::ref(out));
+}
+
+void stop_stats_reporter()
+{
+    if (!reporter.joinable())
+        return;
+    {
+        std::unique_lock lock(reporter_lock);
+        reporter_stopping = true;
+    }
+    reporter_wake.notify_one();
+    reporter.join();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// Power of two buckets, n holds 2^n up to 2^(n+1) - 1 (0 too for the first), the last one everything from 2^31 up
+#define HISTOGRAM_BUCKETS 32
+
+/*
+ * Counters and histograms are updated with relaxed atomics and nothing
+ * else, so they're cheap enough for the per-frame paths. Readers get a
+ * value that may be a moment stale but never torn.
+ */
+class Counter {
+    std::atomic<uint64_t> m_value{0};
+
+    public:
+        void add(uint64_t amount = 1) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+        uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+};
+
+class Gauge {
+    std::atomic<int64_t> m_value{0};
+
+    public:
+        void set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+        int64_t value() const { return m_value.load(std::memory_order_relaxed); }
+};
+
+struct HistogramSnapshot
+{
+    uint64_t buckets[HISTOGRAM_BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    // What was recorded between earlier and this one
+    HistogramSnapshot since(const HistogramSnapshot &earlier) const;
+    // Upper bound of the bucket holding the q quantile, 0 when empty
+    uint64_t quantile(double q) const;
+    uint64_t mean() const;
+};
+
+// Counts values into power of two buckets: [0, 1], [2, 3], [4, 7] and so on
+class Histogram {
+    std::atomic<uint64_t> m_buckets[HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+
+    public:
+        void record(uint64_t value);
+        HistogramSnapshot snapshot() const;
+};
+
+// Everything the rig reports while it runs
+struct Metrics
+{
+    Counter viewfinder_frames;
+    // gaps in the viewfinder sequence numbers, frames the camera never delivered
+    Counter camera_frames_dropped;
+    // frames replaced by a newer one before the display worker sent them
+    Counter display_frames_dropped;
+    Counter stills_captured;
+    // stills discarded for want of a free buffer, or discarded or written raw because the writer queue was full
+    Counter stills_dropped;
+    Gauge writer_queue_depth;
+    // time to encode and write each still, in microseconds
+    Histogram encode_us;
+    Counter bytes_written;
+};
+
+Metrics &metrics();
+
+/*
+ * Prints a one line summary of the last interval to out every
+ * intervalSeconds, from its own thread, until stop_stats_reporter().
+ */
+void start_stats_reporter(unsigned int intervalSeconds, std::ostream &out);
+void stop_stats_reporter();
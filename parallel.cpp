@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "parallel.hpp"
+
+// More bands than threads so a slow core doesn't hold everyone up
+#define BANDS_PER_THREAD 2
+
+// Set while this thread runs a band, so nested parallel_for calls run inline
+static thread_local bool in_band = false;
+
+namespace {
+
+// One parallel_for call, on its caller's stack for as long as it's queued
+struct BandJob
+{
+    BandFunction function;
+    void *context;
+    size_t count;
+    size_t bands;
+    size_t next_band = 0;
+    size_t finished = 0;
+    BandJob *older = nullptr;
+};
+
+}
+
+class BandPool
+{
+    std::vector<std::thread> m_workers;
+    std::mutex m_lock;
+    std::condition_variable m_work_ready;
+    std::condition_variable m_work_done;
+    // newest first, workers help whichever job came last
+    BandJob *m_jobs = nullptr;
+    bool m_stopping = false;
+
+    BandJob *jobWithBandsLeft()
+    {
+        for (BandJob *job = m_jobs; job; job = job->older)
+            if (job->next_band < job->bands)
+                return job;
+        return nullptr;
+    }
+
+    // Runs one of job's bands with m_lock held on entry and exit
+    void runBand(BandJob &job, std::unique_lock<std::mutex> &lock)
+    {
+        size_t band = job.next_band++;
+        size_t begin = job.count * band / job.bands;
+        size_t end = job.count * (band + 1) / job.bands;
+
+        lock.unlock();
+        in_band = true;
+        job.function(job.context, begin, end);
+        in_band = false;
+        lock.lock();
+
+        if (++job.finished == job.bands)
+            m_work_done.notify_all();
+    }
+
+    void worker()
+    {
+        std::unique_lock lock(m_lock);
+        while (true)
+        {
+            BandJob *job = nullptr;
+            m_work_ready.wait(lock, [this, &job] { return m_stopping || (job = jobWithBandsLeft()); });
+            if (m_stopping)
+                return;
+            runBand(*job, lock);
+        }
+    }
+
+public:
+    BandPool()
+    {
+        unsigned int cores = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned int i = 1; i < cores; i++)
+            m_workers.emplace_back(&BandPool::worker, this);
+    }
+
+    ~BandPool()
+    {
+        {
+            std::unique_lock lock(m_lock);
+            m_stopping = true;
+        }
+        m_work_ready.notify_all();
+        for (auto &worker : m_workers)
+            worker.join();
+    }
+
+    unsigned int threads() const
+    {
+        return m_workers.size() + 1;
+    }
+
+    void run(size_t count, BandFunction function, void *context)
+    {
+        size_t bands = std::min<size_t>(count, threads() * BANDS_PER_THREAD);
+        if (bands <= 1 || in_band)
+        {
+            if (count)
+                function(context, 0, count);
+            return;
+        }
+
+        BandJob job = {function, context, count, bands};
+        std::unique_lock lock(m_lock);
+        job.older = m_jobs;
+        m_jobs = &job;
+        m_work_ready.notify_all();
+
+        // only ever our own bands, so a long job elsewhere can't hold this caller up
+        while (job.next_band < job.bands)
+            runBand(job, lock);
+        m_work_done.wait(lock, [&job] { return job.finished == job.bands; });
+
+        BandJob **link = &m_jobs;
+        while (*link != &job)
+            link = &(*link)->older;
+        *link = job.older;
+    }
+};
+
+static BandPool &band_pool()
+{
+    static BandPool pool;
+    return pool;
+}
+
+void parallel_for_bands(size_t count, BandFunction function, void *context)
+{
+    band_pool().run(count, function, context);
+}
+
+unsigned int parallel_threads()
+{
+    return band_pool().threads();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+using BandFunction = void (*)(void *context, size_t begin, size_t end);
+
+void parallel_for_bands(size_t count, BandFunction function, void *context);
+
+/*
+ * Splits [0, count) into contiguous bands and runs body(begin, end) on
+ * them across all cores, the calling thread included, returning once
+ * every band is done. The worker threads start on first use and live for
+ * the rest of the process.
+ *
+ * Calls from several threads run side by side: each caller works through
+ * its own bands while idle workers help the newest job first, so a small
+ * viewfinder conversion isn't stuck behind a still being encoded. A call
+ * made from inside a band runs inline on that thread. body is called
+ * through a pointer rather than wrapped in a std::function, so nothing
+ * is allocated.
+ */
+template <typename Body>
+void parallel_for(size_t count, Body &&body)
+{
+    using BodyType = std::remove_reference_t<Body>;
+    parallel_for_bands(count, [](void *context, size_t begin, size_t end) {
+        (*static_cast<BodyType *>(context))(begin, end);
+    }, const_cast<void *>(static_cast<const void *>(&body)));
+}
+
+unsigned int parallel_threads();
@@ -0,0 +1,92 @@
+#include <wiringPi.h>
+#include "parallel_bus.hpp"
+
+// drive the data bus through the mmapped GPIO registers rather than wiringPi
+#define USE_GPIO_REGISTERS (1)
+
+WiringPiBus::WiringPiBus(int wr)
+    : m_wr(wr)
+{
+}
+
+void WiringPiBus::write(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        digitalWriteByte(data[i]);
+        digitalWrite(m_wr, LOW);
+        digitalWrite(m_wr, HIGH);
+    }
+}
+
+ParallelDisplayBus::ParallelDisplayBus(std::unique_ptr<ParallelBus> bus, int cs, int cd, int rst)
+    : m_bus(std::move(bus)), m_cs(cs), m_cd(cd), m_rst(rst)
+{
+}
+
+void ParallelDisplayBus::setSpeed(uint32_t)
+{
+}
+
+void ParallelDisplayBus::setChipSelect(bool asserted)
+{
+    digitalWrite(m_cs, asserted ? LOW : HIGH);
+}
+
+void ParallelDisplayBus::setDataMode(bool data)
+{
+    digitalWrite(m_cd, data ? HIGH : LOW);
+}
+
+void ParallelDisplayBus::reset()
+{
+    if (m_rst != -1)
+    {
+        digitalWrite(m_rst, LOW);
+        ::delay(50);
+        digitalWrite(m_rst, HIGH);
+        ::delay(50);
+    }
+}
+
+void ParallelDisplayBus::delay(unsigned int ms)
+{
+    ::delay(ms);
+}
+
+void ParallelDisplayBus::write(const uint8_t *data, size_t length)
+{
+    m_bus->write(data, length);
+}
+
+void ParallelDisplayBus::writeBulk(const uint8_t *data, size_t length)
+{
+    m_bus->write(data, length);
+}
+
+std::unique_ptr<DisplayBus> make_parallel_bus(int cs, int rs, int rd, int wr, int rst)
+{
+    // setup all the pins for output
+    for (int i = 0; i < 8; i++) {
+        pinMode(i, OUTPUT);
+    }
+    pinMode(cs, OUTPUT);
+    pinMode(rs, OUTPUT);
+    pinMode(rd, OUTPUT);
+    pinMode(wr, OUTPUT);
+    if (rst != -1)
+        pinMode(rst, OUTPUT);
+
+    digitalWrite(rd, HIGH);
+    digitalWrite(wr, LOW);
+
+    std::unique_ptr<ParallelBus> dataBus;
+#if USE_GPIO_REGISTERS
+    auto registerBus = std::make_unique<GpioRegisterBus<MappedGpioRegisters>>(TP28017_DATA_PINS, wr);
+    if (registerBus->registers().isMapped())
+        dataBus = std::move(registerBus);
+#endif
+    if (!dataBus)
+        dataBus = std::make_unique<WiringPiBus>(wr);
+    return std::make_unique<ParallelDisplayBus>(std::move(dataBus), cs, rs, rst);
+}
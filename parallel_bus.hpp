@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "display_bus.hpp"
+#include "gpio_registers.hpp"
+
+// The TP28017's D0-D7 are wiringPi pins 0-7, these are their BCM numbers
+static const int TP28017_DATA_PINS[8] = {17, 18, 27, 22, 23, 24, 25, 4};
+
+/*
+ * The 8 bit 8080-style data bus of the TP28017: each byte is put on the
+ * data lines and latched by the rising edge of WR. CS, C/D and RD are
+ * left to the display since they only change per command.
+ */
+class ParallelBus {
+    public:
+        virtual ~ParallelBus() = default;
+        virtual void write(const uint8_t *data, size_t length) = 0;
+};
+
+/*
+ * DisplayBus over a ParallelBus, with CS, C/D and RST on wiringPi pins.
+ * Bytes are strobed out with GPIO stores, so there are no syscalls and
+ * no bit clock to set.
+ */
+class ParallelDisplayBus : public DisplayBus {
+    std::unique_ptr<ParallelBus> m_bus;
+    int m_cs;
+    int m_cd;
+    int m_rst;
+    public:
+        ParallelDisplayBus(std::unique_ptr<ParallelBus> bus, int cs, int cd, int rst = -1);
+        void setSpeed(uint32_t hz) override;
+        void setChipSelect(bool asserted) override;
+        void setDataMode(bool data) override;
+        void reset() override;
+        void delay(unsigned int ms) override;
+        void write(const uint8_t *data, size_t length) override;
+        void writeBulk(const uint8_t *data, size_t length) override;
+};
+
+/*
+ * Sets up the TP28017's pins with wiringPi and returns its bus, on the
+ * GPIO registers when /dev/gpiomem can be mapped or WiringPiBus when not.
+ */
+std::unique_ptr<DisplayBus> make_parallel_bus(int cs, int rs, int rd, int wr, int rst = -1);
+
+// wiringPi digitalWriteByte() on wiringPi pins 0-7 and digitalWrite() for WR
+class WiringPiBus : public ParallelBus {
+    int m_wr;
+    public:
+        WiringPiBus(int wr);
+        void write(const uint8_t *data, size_t length) override;
+};
+
+/*
+ * Drives the bus with direct GPIO register stores: one clear (the byte's
+ * zero bits and WR low), one set (the byte's one bits) and one set of WR
+ * per byte, using masks precomputed for all 256 values. Registers is
+ * MappedGpioRegisters on the Pi or FakeGpioRegisters in tests.
+ */
+template <typename Registers>
+class GpioRegisterBus : public ParallelBus {
+    Registers m_registers;
+    uint32_t m_wr_mask;
+    uint32_t m_set[256];
+    uint32_t m_clear[256];
+
+    public:
+        // dataPins are the BCM pins for D0-D7, wr the BCM pin for WR
+        GpioRegisterBus(const int (&dataPins)[8], int wr)
+            : m_wr_mask(1u << wr)
+        {
+            uint32_t dataMask = 0;
+            for (int pin : dataPins)
+                dataMask |= 1u << pin;
+            for (int value = 0; value < 256; value++)
+            {
+                m_set[value] = 0;
+                for (int bit = 0; bit < 8; bit++)
+                    if (value & (1 << bit))
+                        m_set[value] |= 1u << dataPins[bit];
+                m_clear[value] = (dataMask & ~m_set[value]) | m_wr_mask;
+            }
+
+            if (!m_registers.isMapped())
+                return;
+            for (int pin : dataPins)
+                m_registers.setOutput(pin);
+            m_registers.setOutput(wr);
+            m_registers.set(m_wr_mask);
+        }
+
+        Registers &registers() { return m_registers; }
+
+        void write(const uint8_t *data, size_t length) override
+        {
+            size_t i = 0;
+            for (; i + 4 <= length; i += 4)
+            {
+                writeByte(data[i]);
+                writeByte(data[i + 1]);
+                writeByte(data[i + 2]);
+                writeByte(data[i + 3]);
+            }
+            for (; i < length; i++)
+                writeByte(data[i]);
+        }
+
+    private:
+        inline void writeByte(uint8_t value)
+        {
+            m_registers.clear(m_clear[value]);
+            m_registers.set(m_set[value]);
+            m_registers.set(m_wr_mask);
+        }
+};
@@ -0,0 +1,120 @@
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "parallel_bus.hpp"
+
+// BCM pin the TP28017's WR is wired to, camera.cpp runs wiringPi in BCM numbering
+#define WR_PIN 26
+
+// wiringPi pins 0-7 on every 40 pin Pi, from wiringPi's own pin table
+static const int WIRINGPI_TO_BCM[8] = {17, 18, 27, 22, 23, 24, 25, 4};
+
+struct Store
+{
+    unsigned int offset;
+    uint32_t mask;
+};
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAIL " << what << std::endl;
+        failures++;
+    }
+}
+
+// What each data pin should be for value, worked out from the wiringPi table rather than the bus's masks
+static uint32_t data_mask(uint8_t value)
+{
+    uint32_t mask = 0;
+    for (int bit = 0; bit < 8; bit++)
+        if (value & (1 << bit))
+            mask |= 1u << WIRINGPI_TO_BCM[bit];
+    return mask;
+}
+
+static uint8_t decode(uint32_t level)
+{
+    uint8_t value = 0;
+    for (int bit = 0; bit < 8; bit++)
+        if (level & (1u << WIRINGPI_TO_BCM[bit]))
+            value |= 1 << bit;
+    return value;
+}
+
+static void check_setup()
+{
+    GpioRegisterBus<FakeGpioRegisters> bus(TP28017_DATA_PINS, WR_PIN);
+    FakeGpioRegisters &registers = bus.registers();
+    for (int pin : WIRINGPI_TO_BCM)
+    {
+        uint32_t fsel = registers.memory[GPIO_GPFSEL0 / 4 + pin / 10] >> (pin % 10) * 3 & 7;
+        check(fsel == GPIO_FSEL_OUTPUT, "data pin " + std::to_string(pin) + " is an output");
+    }
+    uint32_t fsel = registers.memory[GPIO_GPFSEL0 / 4 + WR_PIN / 10] >> (WR_PIN % 10) * 3 & 7;
+    check(fsel == GPIO_FSEL_OUTPUT, "WR is an output");
+    check(registers.level() & (1u << WR_PIN), "WR idles high");
+}
+
+/*
+ * Every byte must take exactly three stores: a clear of its zero bits
+ * with WR pulled low, a set of its one bits, then WR raised on its own.
+ * The panel latches on the rising edge, so the data lines have to hold
+ * the byte by then.
+ */
+static void check_write(const std::vector<uint8_t> &data, const std::string &what)
+{
+    GpioRegisterBus<FakeGpioRegisters> bus(TP28017_DATA_PINS, WR_PIN);
+    FakeGpioRegisters &registers = bus.registers();
+    const uint32_t wr = 1u << WR_PIN;
+    const uint32_t allData = data_mask(0xFF);
+
+    std::vector<Store> stores;
+    std::vector<uint8_t> latched;
+    registers.onStore = [&stores](unsigned int offset, uint32_t mask) { stores.push_back({offset, mask}); };
+    registers.onChange = [&latched, wr](uint32_t before, uint32_t after) {
+        if (!(before & wr) && (after & wr))
+            latched.push_back(decode(after));
+    };
+
+    bus.write(data.data(), data.size());
+
+    check(stores.size() == data.size() * 3, what + ": three stores per byte");
+    for (size_t i = 0; i < data.size() && i * 3 + 2 < stores.size(); i++)
+    {
+        const Store *byte = &stores[i * 3];
+        const std::string where = what + " byte " + std::to_string(i);
+        check(byte[0].offset == GPIO_GPCLR0 && byte[0].mask == ((allData & ~data_mask(data[i])) | wr),
+              where + ": clears the zero bits and WR");
+        check(byte[1].offset == GPIO_GPSET0 && byte[1].mask == data_mask(data[i]),
+              where + ": sets the one bits");
+        check(byte[2].offset == GPIO_GPSET0 && byte[2].mask == wr, where + ": raises WR alone");
+    }
+    check(latched == data, what + ": bytes latched on WR's rising edges");
+    check(registers.level() & wr, what + ": WR left high");
+}
+
+int main()
+{
+    check_setup();
+
+    std::vector<uint8_t> everyValue(256);
+    for (int value = 0; value < 256; value++)
+        everyValue[value] = value;
+    check_write(everyValue, "every value");
+
+    // each remainder of the 4x unrolled loop
+    for (size_t length = 0; length < 9; length++)
+    {
+        std::vector<uint8_t> data(length);
+        for (size_t i = 0; i < length; i++)
+            data[i] = (uint8_t)(i * 37 + 11);
+        check_write(data, std::to_string(length) + " bytes");
+    }
+
+    std::cout << (failures ? "FAIL" : "ok") << " GpioRegisterBus" << std::endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "replay_source.hpp"
+#include "frame_trace.hpp"
+
+// Full resolution stills that can be queued for writing at once, as for the camera
+#define REPLAY_STILL_POOL_SIZE 4
+
+bool parse_replay_format(const std::string &name, ReplayOptions &options)
+{
+    static const struct
+    {
+        const char *name;
+        PixelColourFormat format;
+        unsigned int bytesPerPixel;
+    } formats[] = {
+        {"yuyv", PixelColourFormat::YUYV, 2},
+        {"rgb888", PixelColourFormat::RGB888, 3},
+        {"xrgb8888", PixelColourFormat::XRGB8888, 4},
+        {"srggb12", PixelColourFormat::SRGGB12, 2},
+        {"sgrbg12", PixelColourFormat::SGRBG12, 2},
+        {"sgbrg12", PixelColourFormat::SGBRG12, 2},
+        {"sbggr12", PixelColourFormat::SBGGR12, 2},
+    };
+
+    for (const auto &format : formats)
+    {
+        if (strcasecmp(name.c_str(), format.name) == 0)
+        {
+            options.format = format.format;
+            options.bytes_per_pixel = format.bytesPerPixel;
+            return true;
+        }
+    }
+    return false;
+}
+
+ReplaySource::ReplaySource(const ReplayOptions &options, FrameHandler frameHandler)
+    : m_options(options), m_frame_handler(std::move(frameHandler))
+{
+    if (m_options.stride == 0)
+        m_options.stride = m_options.width * m_options.bytes_per_pixel;
+}
+
+ReplaySource::~ReplaySource()
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::unique_lock lock(m_lock);
+            m_stopping = true;
+        }
+        m_cond.notify_one();
+        m_thread.join();
+    }
+    m_frames.clear();
+    if (m_map)
+        munmap(m_map, m_map_length);
+}
+
+bool ReplaySource::open()
+{
+    if (m_options.width <= 0 || m_options.height <= 0)
+    {
+        std::cerr << "Replay needs the frame size" << std::endl;
+        return false;
+    }
+    if (m_options.stride < m_options.width * m_options.bytes_per_pixel)
+    {
+        std::cerr << "Replay stride " << m_options.stride << " is shorter than a row" << std::endl;
+        return false;
+    }
+
+    int fd = ::open(m_options.filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Failed to open " << m_options.filename << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+    {
+        std::cerr << "Failed to stat " << m_options.filename << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return false;
+    }
+
+    m_frame_size = (size_t)m_options.stride * m_options.height;
+    const size_t count = info.st_size / m_frame_size;
+    if (count == 0)
+    {
+        std::cerr << m_options.filename << " is smaller than one " << m_options.width << "x"
+                  << m_options.height << " frame" << std::endl;
+        close(fd);
+        return false;
+    }
+    if (info.st_size % m_frame_size)
+        std::cerr << "Ignoring " << info.st_size % m_frame_size << " trailing bytes in " << m_options.filename << std::endl;
+
+    // private and writable because Image hands out mutable spans, nothing is written back
+    m_map_length = count * m_frame_size;
+    void *map = mmap(nullptr, m_map_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cerr << "Failed to map " << m_options.filename << ": " << strerror(errno) << std::endl;
+        m_map_length = 0;
+        return false;
+    }
+    m_map = static_cast<uint8_t *>(map);
+    madvise(m_map, m_map_length, MADV_SEQUENTIAL);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        libcamera::Span<uint8_t> data(m_map + i * m_frame_size, m_frame_size);
+        m_frames.push_back(Image::fromMemory(data, m_options.width, m_options.height,
+                                             m_options.stride, m_options.format));
+    }
+    m_still_pool = std::make_shared<FramePool>(REPLAY_STILL_POOL_SIZE, m_frame_size);
+
+    std::cout << "Replaying " << count << " frames from " << m_options.filename << std::endl;
+    return true;
+}
+
+void ReplaySource::start()
+{
+    m_thread = std::thread(&ReplaySource::run, this);
+}
+
+void ReplaySource::requestStillFrame()
+{
+    std::unique_lock lock(m_lock);
+    m_still_requested = true;
+}
+
+void ReplaySource::release(const CapturedFrame &)
+{
+    {
+        std::unique_lock lock(m_lock);
+        m_in_flight--;
+    }
+    m_cond.notify_one();
+}
+
+std::shared_ptr<FramePool> ReplaySource::stillPool() const
+{
+    return m_still_pool;
+}
+
+size_t ReplaySource::frameCount() const
+{
+    return m_frames.size();
+}
+
+void ReplaySource::run()
+{
+    using clock = std::chrono::steady_clock;
+    const clock::duration interval = m_options.fps > 0
+        ? std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / m_options.fps))
+        : clock::duration::zero();
+    clock::time_point next = clock::now();
+    uint32_t sequence = 0;
+
+    std::unique_lock lock(m_lock);
+    while (true)
+    {
+        // like the camera running out of requests, wait for the pipeline to hand some back
+        m_cond.wait(lock, [this] { return m_stopping || m_in_flight < REPLAY_FRAMES_IN_FLIGHT; });
+        if (interval != clock::duration::zero())
+        {
+            m_cond.wait_until(lock, next, [this] { return m_stopping; });
+            // when the pipeline falls behind, carry on from now rather than bursting to catch up
+            next = std::max(next + interval, clock::now());
+        }
+        if (m_stopping)
+            return;
+
+        const bool still = m_still_requested ||
+            (m_options.still_interval && sequence % m_options.still_interval == m_options.still_interval - 1);
+        m_still_requested = false;
+        m_in_flight += still ? 2 : 1;
+        lock.unlock();
+
+        CapturedFrame frame;
+        frame.image = m_frames[sequence % m_frames.size()].get();
+        frame.info.sequence = sequence;
+        frame.info.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::now().time_since_epoch()).count();
+        frame.info.exposure_us = std::chrono::duration_cast<std::chrono::microseconds>(interval).count();
+        frame.info.analogue_gain = 1.0f;
+
+        frame.cookie = VIEWFINDER_COOKIE;
+        trace_frame(TraceStage::Sensor, frame.info.sequence, frame.info.timestamp_ns);
+        trace_frame(TraceStage::RequestComplete, frame.info.sequence);
+        m_frame_handler(frame);
+        if (still)
+        {
+            frame.cookie = STILL_CAPTURE_COOKIE;
+            m_frame_handler(frame);
+        }
+        sequence++;
+
+        lock.lock();
+    }
+}
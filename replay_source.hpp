@@ -0,0 +1,73 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "frame_source.hpp"
+
+// Frames handed out and not yet released, like the camera's queued requests
+#define REPLAY_FRAMES_IN_FLIGHT 4
+
+struct ReplayOptions
+{
+    std::string filename;
+    int width = 0;
+    int height = 0;
+    // bytes per row, 0 for tightly packed rows
+    unsigned int stride = 0;
+    PixelColourFormat format = PixelColourFormat::YUYV;
+    // must match format, 3 for RGB888
+    unsigned int bytes_per_pixel = 2;
+    // frames per second, 0 to go as fast as the frames are released
+    double fps = 30;
+    // deliver every nth frame as a still too, 0 for only on requestStillFrame()
+    unsigned int still_interval = 0;
+};
+
+/*
+ * Parses yuyv, rgb888, xrgb8888 or a 12 bit Bayer order (srggb12 etc.)
+ * into options.format and options.bytes_per_pixel. False for anything else.
+ */
+bool parse_replay_format(const std::string &name, ReplayOptions &options);
+
+/*
+ * Plays back a recording in place of the camera. The file is headerless,
+ * just frames of stride * height bytes back to back, as written by
+ * Image::writeRawToFile or ffmpeg's rawvideo muxer, and is mapped rather
+ * than read so nothing is copied on the way to the viewfinder. Frames go
+ * round in a loop with the same cookies and per-frame details as camera
+ * requests, so the rest of the pipeline can't tell the difference.
+ */
+class ReplaySource : public FrameSource {
+    ReplayOptions m_options;
+    FrameHandler m_frame_handler;
+    uint8_t *m_map = nullptr;
+    size_t m_map_length = 0;
+    size_t m_frame_size = 0;
+    std::vector<std::unique_ptr<Image>> m_frames;
+    std::shared_ptr<FramePool> m_still_pool;
+    unsigned int m_in_flight = 0;
+    bool m_still_requested = false;
+    bool m_stopping = false;
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+
+    public:
+        ReplaySource(const ReplayOptions &options, FrameHandler frameHandler);
+        ~ReplaySource();
+
+        // False, with the reason on std::cerr, when the recording can't be used
+        bool open();
+        void start() override;
+        void requestStillFrame() override;
+        void release(const CapturedFrame &frame) override;
+        std::shared_ptr<FramePool> stillPool() const override;
+        size_t frameCount() const;
+
+    private:
+        void run();
+};
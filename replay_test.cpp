@@ -0,0 +1,186 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "display_worker.hpp"
+#include "replay_source.hpp"
+
+// The ILI9341 in landscape, what the viewfinder converts each frame for
+#define PANEL_WIDTH 320
+#define PANEL_HEIGHT 240
+// Frames in the recording, played round twice
+#define RECORDED_FRAMES 3
+#define PLAYED_FRAMES (RECORDED_FRAMES * 2)
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::cerr << "FAIL " << what << std::endl;
+        failures++;
+    }
+}
+
+static void check_equal(uint64_t actual, uint64_t expected, const std::string &what)
+{
+    if (actual != expected)
+        std::cerr << what << ": got " << actual << " expected " << expected << std::endl;
+    check(actual == expected, what);
+}
+
+// Each frame is one colour, so any part of the panel shows which frame it came from
+static void frame_colour(int frame, uint8_t bgr[3])
+{
+    bgr[0] = 0x20 + frame * 0x31;
+    bgr[1] = 0x90 - frame * 0x17;
+    bgr[2] = 0xe0 - frame * 0x45;
+}
+
+// Writes RECORDED_FRAMES frames as ffmpeg's rawvideo muxer would, with the padding left at 0xaa
+static std::string write_recording(int width, int height, unsigned int stride, unsigned int bytesPerPixel)
+{
+    char path[] = "/tmp/replay-test-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return "";
+    close(fd);
+
+    std::vector<uint8_t> frame(stride * height, 0xaa);
+    std::ofstream file(path, std::ios::binary);
+    for (int i = 0; i < RECORDED_FRAMES; i++)
+    {
+        uint8_t bgr[3];
+        frame_colour(i, bgr);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t *pixel = &frame[y * stride + x * bytesPerPixel];
+                pixel[0] = bgr[0];
+                pixel[1] = bgr[1];
+                pixel[2] = bgr[2];
+                if (bytesPerPixel == 4)
+                    pixel[3] = 0xff;
+            }
+        }
+        file.write(reinterpret_cast<const char *>(frame.data()), frame.size());
+    }
+    return path;
+}
+
+/*
+ * Plays a recording through the same path as the viewfinder, converting
+ * each frame into the display worker's back buffer and presenting it,
+ * and checks every one is drawn as a full panel of the right colour.
+ * The handler waits for each frame to be drawn, so none are replaced in
+ * the handoff slot before the draw function sees them.
+ */
+static void check_replay(const std::string &name, const std::string &format, int width, int height,
+                         unsigned int stride, PanelFormat panelFormat)
+{
+    ReplayOptions options;
+    options.width = width;
+    options.height = height;
+    options.stride = stride;
+    options.fps = 0;
+    check(parse_replay_format(format, options), name + " format");
+    options.filename = write_recording(width, height,
+                                       stride ? stride : width * options.bytes_per_pixel,
+                                       options.bytes_per_pixel);
+    check(!options.filename.empty(), name + " recording");
+
+    const size_t panelLength = (size_t)PANEL_WIDTH * PANEL_HEIGHT * panel_bytes_per_pixel(panelFormat);
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<std::vector<uint8_t>> drawn;
+    unsigned int presented = 0;
+
+    DisplayWorker worker([&](libcamera::Span<uint8_t> &data) {
+        std::unique_lock guard(lock);
+        drawn.emplace_back(data.begin(), data.end());
+        cond.notify_all();
+    });
+
+    {
+        ReplaySource *source = nullptr;
+        ReplaySource replay(options, [&](const CapturedFrame &frame) {
+            if (frame.cookie == VIEWFINDER_COOKIE && frame.info.sequence < PLAYED_FRAMES)
+            {
+                auto output = worker.backBuffer(panelLength);
+                const size_t length = frame.image->dataAsPanel(output, PANEL_WIDTH, PANEL_HEIGHT,
+                                                               panelFormat, ResampleFilter::Bilinear);
+                std::unique_lock guard(lock);
+                if (length)
+                {
+                    presented++;
+                    guard.unlock();
+                    worker.present(length, frame.info.sequence);
+                    guard.lock();
+                    cond.wait_for(guard, std::chrono::seconds(5), [&] { return drawn.size() == presented; });
+                }
+                else
+                {
+                    // what the viewfinder did with RGB888 before it had kernels: nothing reached the panel
+                    presented = PLAYED_FRAMES;
+                }
+                cond.notify_all();
+            }
+            source->release(frame);
+        });
+        source = &replay;
+        check(replay.open(), name + " open");
+        check_equal(replay.frameCount(), RECORDED_FRAMES, name + " frames in the recording");
+        replay.start();
+
+        std::unique_lock guard(lock);
+        cond.wait_for(guard, std::chrono::seconds(10), [&] { return presented == PLAYED_FRAMES; });
+    }
+    unlink(options.filename.c_str());
+
+    check_equal(drawn.size(), PLAYED_FRAMES, name + " frames reaching the panel");
+    for (size_t i = 0; i < drawn.size(); i++)
+    {
+        const std::string what = name + " frame " + std::to_string(i);
+        check_equal(drawn[i].size(), panelLength, what + " length");
+        if (panelFormat != PanelFormat::BGR888 || drawn[i].size() != panelLength)
+            continue;
+
+        uint8_t bgr[3];
+        frame_colour(i % RECORDED_FRAMES, bgr);
+        size_t wrong = 0;
+        for (size_t j = 0; j < panelLength; j += 3)
+        {
+            if (drawn[i][j] != bgr[0] || drawn[i][j + 1] != bgr[1] || drawn[i][j + 2] != bgr[2])
+                wrong++;
+        }
+        check_equal(wrong, 0, what + " pixels not the frame's colour");
+    }
+}
+
+int main()
+{
+    const unsigned int padded = PANEL_WIDTH * 3 + 64;
+
+    check_replay("RGB888", "rgb888", PANEL_WIDTH, PANEL_HEIGHT, 0, PanelFormat::BGR888);
+    check_replay("RGB888 padded rows", "rgb888", PANEL_WIDTH, PANEL_HEIGHT, padded, PanelFormat::BGR888);
+    check_replay("RGB888 resampled", "rgb888", PANEL_WIDTH * 2, PANEL_HEIGHT * 2, 0, PanelFormat::BGR888);
+    check_replay("RGB888 to RGB565", "rgb888", PANEL_WIDTH, PANEL_HEIGHT, 0, PanelFormat::BGR565);
+    check_replay("RGB888 resampled to RGB565", "rgb888", PANEL_WIDTH * 2, PANEL_HEIGHT * 2, 0, PanelFormat::BGR565);
+    check_replay("XRGB8888", "xrgb8888", PANEL_WIDTH, PANEL_HEIGHT, 0, PanelFormat::BGR888);
+
+    if (failures)
+    {
+        std::cerr << failures << " replay checks failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "Every replayed frame reached the panel" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <string.h>
+#include <vector>
+#include "resample.hpp"
+#include "colour_convert.hpp"
+#include "parallel.hpp"
+
+// bilinear weights are 8 bit fractions
+#define WEIGHT_BITS 8
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+// Where each output column or row samples the source
+struct SampleMap
+{
+    std::vector<int> first;
+    std::vector<int> last;   // one past the end for Box, the second sample for Bilinear
+    std::vector<int> weight; // of the second sample, Bilinear only
+};
+
+static SampleMap build_sample_map(int source, int output, ResampleFilter filter)
+{
+    SampleMap map;
+    map.first.resize(output);
+    map.last.resize(output);
+    map.weight.resize(output);
+    for (int i = 0; i < output; i++)
+    {
+        if (filter == ResampleFilter::Nearest)
+        {
+            // centre of the output pixel
+            int centre = (int)(((int64_t)(2 * i + 1) * source) / (2 * output));
+            map.first[i] = map.last[i] = std::min(centre, source - 1);
+        }
+        else if (filter == ResampleFilter::Bilinear)
+        {
+            int64_t position = ((int64_t)(2 * i + 1) * source * WEIGHT_ONE) / (2 * output) - WEIGHT_ONE / 2;
+            position = std::max<int64_t>(position, 0);
+            map.first[i] = std::min((int)(position >> WEIGHT_BITS), source - 1);
+            map.last[i] = std::min(map.first[i] + 1, source - 1);
+            map.weight[i] = position & (WEIGHT_ONE - 1);
+        }
+        else
+        {
+            map.first[i] = (int)(((int64_t)i * source) / output);
+            map.last[i] = std::max(map.first[i] + 1, (int)(((int64_t)(i + 1) * source) / output));
+        }
+    }
+    return map;
+}
+
+// Decodes one source row into 3 bytes per pixel, in the order the BGR888 kernels write them
+static void decode_row(const uint8_t *src, int width, ResampleInput input, uint8_t *dst)
+{
+    switch (input)
+    {
+        case ResampleInput::RGB888:
+            memcpy(dst, src, width * 3);
+            break;
+        case ResampleInput::XRGB8888:
+            convert_xrgb8888_to_bgr888(src, dst, width);
+            break;
+        case ResampleInput::YUYV:
+            convert_yuyv_to_bgr888(src, dst, width & ~1);
+            if (width & 1)
+            {
+                // the last pixel shares its chroma with one past the edge, repeat its neighbour
+                memcpy(dst + (width - 1) * 3, dst + (width - 2) * 3, 3);
+            }
+            break;
+    }
+}
+
+static inline void store_565(uint8_t *dst, int first, int second, int third)
+{
+    uint16_t rgb = ((first & 0xF8) << 8) | ((second & 0xFC) << 3) | (third >> 3);
+    dst[0] = (uint8_t)(rgb >> 8);
+    dst[1] = (uint8_t)(rgb & 0xFF);
+}
+
+// Packs a row of 3 byte pixels into the panel format
+static void pack_row(const uint8_t *pixels, int width, ResampleInput input, PanelFormat format, uint8_t *dst)
+{
+    // the XXR conversions take the first byte of RGB sources but the average of decoded YUYV
+    const bool average = input == ResampleInput::YUYV;
+    auto mono = [average](const uint8_t *pixel) {
+        return average ? (pixel[0] + pixel[1] + pixel[2]) / 3 : pixel[0];
+    };
+
+    switch (format)
+    {
+        case PanelFormat::BGR888:
+            memcpy(dst, pixels, width * 3);
+            break;
+        case PanelFormat::XXR888:
+            for (int x = 0; x < width; x++, pixels += 3, dst += 3)
+            {
+                dst[0] = mono(pixels);
+                dst[1] = 0;
+                dst[2] = 0;
+            }
+            break;
+        case PanelFormat::BGR565:
+            for (int x = 0; x < width; x++, pixels += 3, dst += 2)
+                store_565(dst, pixels[0], pixels[1], pixels[2]);
+            break;
+        case PanelFormat::XXR565:
+            for (int x = 0; x < width; x++, pixels += 3, dst += 2)
+                store_565(dst, mono(pixels), 0, 0);
+            break;
+    }
+}
+
+size_t panel_bytes_per_pixel(PanelFormat format)
+{
+    return (format == PanelFormat::BGR565 || format == PanelFormat::XXR565) ? 2 : 3;
+}
+
+namespace {
+
+// Decoded source rows, cached by row number
+class RowCache {
+    const uint8_t *m_src = nullptr;
+    int m_width = 0;
+    size_t m_stride = 0;
+    ResampleInput m_input = ResampleInput::RGB888;
+    std::vector<uint8_t> m_rows[2];
+    int m_numbers[2] = {-1, -1};
+
+    public:
+        // Starts on a new frame, keeping the row buffers from the last one
+        void reset(const uint8_t *src, int width, size_t stride, ResampleInput input)
+        {
+            m_src = src;
+            m_width = width;
+            m_stride = stride;
+            m_input = input;
+            m_rows[0].resize(width * 3);
+            m_rows[1].resize(width * 3);
+            m_numbers[0] = m_numbers[1] = -1;
+        }
+
+        // Decoded row y, decoding it over whichever buffer isn't keep
+        const uint8_t *row(int y, const uint8_t *keep = nullptr)
+        {
+            if (m_numbers[0] == y)
+                return m_rows[0].data();
+            if (m_numbers[1] == y)
+                return m_rows[1].data();
+            int slot = m_rows[0].data() == keep ? 1 : 0;
+            decode_row(m_src + y * m_stride, m_width, m_input, m_rows[slot].data());
+            m_numbers[slot] = y;
+            return m_rows[slot].data();
+        }
+};
+
+// Where a resize samples the source, rebuilt only when the sizes or filter change
+struct ResamplePlan
+{
+    int src_width = 0;
+    int src_height = 0;
+    int dst_width = 0;
+    int dst_height = 0;
+    ResampleFilter filter = ResampleFilter::Nearest;
+    SampleMap columns;
+    SampleMap rows;
+
+    void update(int srcWidth, int srcHeight, int dstWidth, int dstHeight, ResampleFilter newFilter)
+    {
+        if (srcWidth == src_width && srcHeight == src_height && dstWidth == dst_width &&
+            dstHeight == dst_height && newFilter == filter)
+            return;
+        columns = build_sample_map(srcWidth, dstWidth, newFilter);
+        rows = build_sample_map(srcHeight, dstHeight, newFilter);
+        src_width = srcWidth;
+        src_height = srcHeight;
+        dst_width = dstWidth;
+        dst_height = dstHeight;
+        filter = newFilter;
+    }
+};
+
+// Each thread's working rows, kept between frames so a steady stream allocates nothing
+struct BandScratch
+{
+    RowCache cache;
+    std::vector<uint8_t> pixels;
+    std::vector<uint32_t> sums;
+};
+
+}
+
+size_t resample_convert(const uint8_t *src, int srcWidth, int srcHeight, size_t srcStride, ResampleInput input,
+                        uint8_t *dst, int dstWidth, int dstHeight, PanelFormat format, ResampleFilter filter)
+{
+    if (srcWidth <= 0 || srcHeight <= 0 || dstWidth <= 0 || dstHeight <= 0)
+        return 0;
+
+    // per calling thread, so the viewfinder and still previews don't evict each other's plan mid frame
+    static thread_local ResamplePlan plan;
+    plan.update(srcWidth, srcHeight, dstWidth, dstHeight, filter);
+    const SampleMap &columns = plan.columns;
+    const SampleMap &rows = plan.rows;
+    const size_t dstBytesPerPixel = panel_bytes_per_pixel(format);
+    const size_t dstStride = dstWidth * dstBytesPerPixel;
+
+    parallel_for(dstHeight, [&](size_t begin, size_t end) {
+        static thread_local BandScratch scratch;
+        RowCache &cache = scratch.cache;
+        std::vector<uint8_t> &pixels = scratch.pixels;
+        std::vector<uint32_t> &sums = scratch.sums;
+        cache.reset(src, srcWidth, srcStride, input);
+        pixels.resize(dstWidth * 3);
+        if (filter == ResampleFilter::Box)
+            sums.resize(dstWidth * 3);
+
+        for (size_t y = begin; y < end; y++)
+        {
+            uint8_t *out = pixels.data();
+            if (filter == ResampleFilter::Nearest)
+            {
+                const uint8_t *row = cache.row(rows.first[y]);
+                for (int x = 0; x < dstWidth; x++, out += 3)
+                    memcpy(out, row + columns.first[x] * 3, 3);
+            }
+            else if (filter == ResampleFilter::Bilinear)
+            {
+                const uint8_t *top = cache.row(rows.first[y]);
+                const uint8_t *bottom = cache.row(rows.last[y], top);
+                const int wy = rows.weight[y];
+                for (int x = 0; x < dstWidth; x++)
+                {
+                    const int left = columns.first[x] * 3, right = columns.last[x] * 3;
+                    const int wx = columns.weight[x];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int upper = top[left + c] * (WEIGHT_ONE - wx) + top[right + c] * wx;
+                        int lower = bottom[left + c] * (WEIGHT_ONE - wx) + bottom[right + c] * wx;
+                        *out++ = (upper * (WEIGHT_ONE - wy) + lower * wy + (1 << (2 * WEIGHT_BITS - 1))) >> (2 * WEIGHT_BITS);
+                    }
+                }
+            }
+            else
+            {
+                std::fill(sums.begin(), sums.end(), 0);
+                for (int sy = rows.first[y]; sy < rows.last[y]; sy++)
+                {
+                    const uint8_t *row = cache.row(sy);
+                    uint32_t *sum = sums.data();
+                    for (int x = 0; x < dstWidth; x++, sum += 3)
+                    {
+                        for (int sx = columns.first[x]; sx < columns.last[x]; sx++)
+                        {
+                            sum[0] += row[sx * 3];
+                            sum[1] += row[sx * 3 + 1];
+                            sum[2] += row[sx * 3 + 2];
+                        }
+                    }
+                }
+                const uint32_t height = rows.last[y] - rows.first[y];
+                const uint32_t *sum = sums.data();
+                for (int x = 0; x < dstWidth; x++)
+                {
+                    const uint32_t count = height * (columns.last[x] - columns.first[x]);
+                    for (int c = 0; c < 3; c++)
+                        *out++ = (*sum++ + count / 2) / count;
+                }
+            }
+            pack_row(pixels.data(), dstWidth, input, format, dst + y * dstStride);
+        }
+    });
+
+    return dstStride * dstHeight;
+}
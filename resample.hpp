@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class ResampleFilter {
+    Nearest,
+    Bilinear,
+    // averages every source pixel under the output pixel, for big downscales
+    Box,
+};
+
+// Source layouts the resampler reads, see Image::resampleInto()
+enum class ResampleInput {
+    RGB888,
+    XRGB8888,
+    YUYV,
+};
+
+// Panel pixel layouts, the same as the matching Image::dataAs* conversions
+enum class PanelFormat {
+    BGR888,
+    XXR888,
+    BGR565,
+    XXR565,
+};
+
+/*
+ * Scales a srcWidth x srcHeight image, rows srcStride bytes apart, to
+ * dstWidth x dstHeight and converts it to the panel format in the same
+ * pass, so there's no full size intermediate frame. Source rows are
+ * decoded with the colour_convert kernels as they're needed and output
+ * rows are produced in bands across all cores. The sample positions and
+ * row buffers are kept between calls, so resizing a stream of frames of
+ * one size allocates nothing after the first.
+ *
+ * dst must have room for dstWidth * dstHeight pixels of the panel
+ * format. Returns the number of bytes written.
+ */
+size_t resample_convert(const uint8_t *src, int srcWidth, int srcHeight, size_t srcStride, ResampleInput input,
+                        uint8_t *dst, int dstWidth, int dstHeight, PanelFormat format, ResampleFilter filter);
+
+size_t panel_bytes_per_pixel(PanelFormat format);
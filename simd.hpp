@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+ * Picks the vector instruction set for the hand written kernels: NEON on
+ * the Pi, SSE2 on x86 with AVX2 chosen at runtime where the CPU has it.
+ */
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON (1)
+#elif defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_SSE2 (1)
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_AVX2 (1)
+#define AVX2 __attribute__((target("avx2")))
+
+static inline bool cpu_has_avx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+#endif
+#endif
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <string.h>
+#include "spi_transfer_queue.hpp"
+
+void SpiBatch::command(uint8_t cmd, const uint8_t *args, size_t count)
+{
+    SpiSegment segment = {true, nullptr, 1, {cmd}};
+    m_segments.push_back(segment);
+
+    // longer argument lists than fit inline go in as several data segments
+    for (size_t offset = 0; offset < count; offset += SPI_SEGMENT_INLINE_BYTES)
+    {
+        SpiSegment arguments = {false, nullptr, std::min<size_t>(count - offset, SPI_SEGMENT_INLINE_BYTES), {}};
+        memcpy(arguments.bytes, args + offset, arguments.length);
+        m_segments.push_back(arguments);
+    }
+}
+
+void SpiBatch::data(uint8_t *data, size_t length)
+{
+    if (length)
+        m_segments.push_back({false, data, length, {}});
+}
+
+const std::vector<SpiSegment> &SpiBatch::segments() const
+{
+    return m_segments;
+}
+
+SpiTransferQueue::SpiTransferQueue(SendFunction send)
+    : m_send(std::move(send))
+{
+    m_thread = std::thread(&SpiTransferQueue::run, this);
+}
+
+SpiTransferQueue::~SpiTransferQueue()
+{
+    {
+        std::unique_lock lock(m_lock);
+        m_stopping = true;
+    }
+    m_work.notify_one();
+    m_thread.join();
+}
+
+TransferToken SpiTransferQueue::submit(SpiBatch batch)
+{
+    std::unique_lock lock(m_lock);
+    TransferToken token = ++m_submitted;
+    m_pending.emplace_back(token, std::move(batch));
+
+    lock.unlock();
+    m_work.notify_one();
+    return token;
+}
+
+bool SpiTransferQueue::isComplete(TransferToken token)
+{
+    std::unique_lock lock(m_lock);
+    return m_completed >= token;
+}
+
+void SpiTransferQueue::wait(TransferToken token)
+{
+    std::unique_lock lock(m_lock);
+    m_done.wait(lock, [this, token] { return m_completed >= token; });
+}
+
+void SpiTransferQueue::waitIdle()
+{
+    std::unique_lock lock(m_lock);
+    m_done.wait(lock, [this] { return m_completed >= m_submitted; });
+}
+
+void SpiTransferQueue::run()
+{
+    std::unique_lock lock(m_lock);
+    while (true)
+    {
+        m_work.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+        if (m_pending.empty()) // only once stopping and everything has been sent
+            return;
+
+        auto [token, batch] = std::move(m_pending.front());
+        m_pending.pop_front();
+        lock.unlock();
+
+        for (const SpiSegment &segment : batch.segments())
+            m_send(segment);
+
+        lock.lock();
+        m_completed = token;
+        m_done.notify_all();
+    }
+}
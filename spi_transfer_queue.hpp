@@ -0,0 +1,75 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Identifies a submitted batch, 0 is always complete
+using TransferToken = uint64_t;
+
+#define SPI_SEGMENT_INLINE_BYTES 16
+
+struct SpiSegment
+{
+    bool command;  // sent with DC low, otherwise DC high
+    uint8_t *data; // caller owned data, or nullptr when the bytes are inline
+    size_t length;
+    uint8_t bytes[SPI_SEGMENT_INLINE_BYTES];
+
+    const uint8_t *begin() const { return data ? data : bytes; }
+};
+
+/*
+ * An ordered run of command and data segments for one display update.
+ * Command bytes and short argument lists are copied into the batch, bulk
+ * data is referenced and must stay untouched until the batch's token has
+ * completed.
+ */
+class SpiBatch {
+    std::vector<SpiSegment> m_segments;
+
+    public:
+        void command(uint8_t cmd, const uint8_t *args = nullptr, size_t count = 0);
+        void data(uint8_t *data, size_t length);
+        const std::vector<SpiSegment> &segments() const;
+};
+
+/*
+ * Sends batches from a dedicated I/O thread, in submission order, so the
+ * caller can prepare the next frame while the current one is on the
+ * wire. The send function does the actual DC, CS and spidev work for a
+ * segment on the I/O thread.
+ */
+class SpiTransferQueue {
+    public:
+        using SendFunction = std::function<void(const SpiSegment &)>;
+
+    private:
+        SendFunction m_send;
+        std::deque<std::pair<TransferToken, SpiBatch>> m_pending;
+        TransferToken m_submitted = 0;
+        TransferToken m_completed = 0;
+        bool m_stopping = false;
+        std::mutex m_lock;
+        std::condition_variable m_work;
+        std::condition_variable m_done;
+        std::thread m_thread;
+
+    public:
+        SpiTransferQueue(SendFunction send);
+        ~SpiTransferQueue();
+
+        TransferToken submit(SpiBatch batch);
+        bool isComplete(TransferToken token);
+        void wait(TransferToken token);
+        // Waits for everything submitted so far
+        void waitIdle();
+
+    private:
+        void run();
+};
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include <wiringPi.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include "spidev_bus.hpp"
+
+// spidev rejects any message whose transfers add up to more than its bufsiz
+// module parameter, 4096 unless raised with spidev.bufsiz= on the kernel command line
+#define SPIDEV_BUFSIZ_PARAMETER "/sys/module/spidev/parameters/bufsiz"
+// newer kernels count each transfer rounded up to the DMA alignment against bufsiz
+#define SPI_DMA_ALIGN 128
+// the BCM2835 takes a 16 bit transfer length, keep each segment within it and aligned
+#define SPI_SEGMENT_SIZE (65536 - SPI_DMA_ALIGN)
+#define SPI_MAX_SEGMENTS 64
+
+static size_t spidev_bufsiz()
+{
+    std::ifstream parameter(SPIDEV_BUFSIZ_PARAMETER);
+    size_t bufsiz = 0;
+    if (!(parameter >> bufsiz) || bufsiz == 0)
+        bufsiz = SPIDEV_DEFAULT_BUFSIZ;
+    return bufsiz;
+}
+
+SpidevBus::SpidevBus(const char *spi_dev, int cs, int dc, int rst, int backlight)
+    : m_cs(cs), m_dc(dc), m_rst(rst), m_spi_bufsiz(spidev_bufsiz())
+{
+    this->m_spi = std::make_unique<spidevpp::Spi>(spi_dev);
+    this->m_spi->setBitsPerWord(8);
+    this->m_spi_fd = open(spi_dev, O_RDWR);
+    if (this->m_spi_fd < 0)
+        std::cerr << "Failed to open " << spi_dev << " for bulk writes: " << strerror(errno) << std::endl;
+
+    pinMode(this->m_cs, OUTPUT);
+    pinMode(this->m_dc, OUTPUT);
+    if (m_rst != -1)
+    {
+        pinMode(m_rst, OUTPUT);
+        pullUpDnControl(m_rst, PUD_UP);
+    }
+    if (backlight != -1)
+    {
+        pinMode(backlight, OUTPUT);
+        digitalWrite(backlight, HIGH);
+    }
+}
+
+SpidevBus::~SpidevBus()
+{
+    if (this->m_spi_fd >= 0)
+        close(this->m_spi_fd);
+}
+
+void SpidevBus::setSpeed(uint32_t hz)
+{
+    this->m_spi_speed = hz;
+    this->m_spi->setSpeed(hz);
+}
+
+void SpidevBus::setChipSelect(bool asserted)
+{
+    digitalWrite(this->m_cs, asserted ? LOW : HIGH);
+}
+
+void SpidevBus::setDataMode(bool data)
+{
+    digitalWrite(this->m_dc, data ? HIGH : LOW);
+}
+
+void SpidevBus::reset()
+{
+    if (this->m_rst != -1)
+    {
+        digitalWrite(this->m_rst, LOW);
+        ::delay(50);
+        digitalWrite(this->m_rst, HIGH);
+        ::delay(50);
+    }
+}
+
+void SpidevBus::delay(unsigned int ms)
+{
+    ::delay(ms);
+}
+
+void SpidevBus::write(const uint8_t *data, size_t length)
+{
+    this->m_spi->write(const_cast<uint8_t *>(data), length);
+}
+
+/*
+ * spidev copies each SPI_IOC_MESSAGE through a bounce buffer of bufsiz
+ * bytes, so that's the most one ioctl can carry however it's split into
+ * transfers. With the default 4096 a 320x240 frame takes one ioctl per
+ * 4 KiB, 38 at RGB565 and 57 at RGB666, which still saves the DC
+ * and CS toggles and per-strip commands of the old path. Raising
+ * spidev.bufsiz lets a message carry the whole frame, split into
+ * transfers the controller can take.
+ */
+void SpidevBus::writeBulk(const uint8_t *data, size_t length)
+{
+    size_t offset = 0;
+    while (offset < length)
+    {
+        if (this->m_spi_fd < 0 || this->m_spi_bufsiz < SPI_DMA_ALIGN)
+        {
+            size_t end = std::min(length, offset + this->m_spi_bufsiz);
+            this->write(data + offset, end - offset);
+            offset = end;
+            continue;
+        }
+
+        struct spi_ioc_transfer transfers[SPI_MAX_SEGMENTS] = {};
+        unsigned int count = 0;
+        size_t budget = this->m_spi_bufsiz;
+        while (offset < length && count < SPI_MAX_SEGMENTS)
+        {
+            // a segment that isn't a multiple of the alignment still costs a whole one
+            size_t segment = std::min({length - offset, (size_t)SPI_SEGMENT_SIZE, budget / SPI_DMA_ALIGN * SPI_DMA_ALIGN});
+            if (segment == 0)
+                break;
+            transfers[count].tx_buf = (uintptr_t)(data + offset);
+            transfers[count].len = segment;
+            transfers[count].speed_hz = this->m_spi_speed;
+            transfers[count].bits_per_word = 8;
+            budget -= (segment + SPI_DMA_ALIGN - 1) / SPI_DMA_ALIGN * SPI_DMA_ALIGN;
+            offset += segment;
+            count++;
+        }
+
+        // SPI_IOC_MESSAGE() wants a constant count, so build the request by hand
+        if (ioctl(this->m_spi_fd, _IOC(_IOC_WRITE, SPI_IOC_MAGIC, 0, SPI_MSGSIZE(count)), transfers) < 0)
+        {
+            std::cerr << "SPI transfer failed: " << strerror(errno) << std::endl;
+            break;
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <spidevpp/spi.h>
+#include "display_bus.hpp"
+
+// spidev for the bytes, wiringPi for CS, DC, RST and the backlight
+class SpidevBus : public DisplayBus {
+    int m_cs;
+    int m_dc;
+    int m_rst;
+    std::unique_ptr<spidevpp::Spi> m_spi;
+    // raw spidev handle for multi-transfer messages
+    int m_spi_fd;
+    uint32_t m_spi_speed = 0;
+    size_t m_spi_bufsiz;
+
+    public:
+        // backlight, if given, is switched on and left on
+        SpidevBus(const char *spi_dev, int cs, int dc, int rst = -1, int backlight = -1);
+        ~SpidevBus();
+        void setSpeed(uint32_t hz) override;
+        void setChipSelect(bool asserted) override;
+        void setDataMode(bool data) override;
+        void reset() override;
+        void delay(unsigned int ms) override;
+        void write(const uint8_t *data, size_t length) override;
+        void writeBulk(const uint8_t *data, size_t length) override;
+};
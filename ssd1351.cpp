@@ -1,7 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <wiringPi.h>
 #include <iostream>
 #include <thread>
 #include <chrono>
@@ -13,8 +12,13 @@
 #define BYTES_PER_PIXEL 3
 
 
-Ssd1351::Ssd1351(const char *spi_dev, int cs, int dc, int rst)
-    : Display(spi_dev, SPI_SPEED, cs, dc, rst)
+Ssd1351::Ssd1351(std::unique_ptr<DisplayBus> bus)
+    : Display(std::move(bus), SPI_SPEED)
+{
+    this->init();
+}
+
+void Ssd1351::init()
 {
     // INIT DISPLAY ------------------------------------------------------------
     this->reset();
@@ -68,6 +72,9 @@ Ssd1351::Ssd1351(const char *spi_dev, int cs, int dc, int rst)
 
 void Ssd1351::drawImage(libcamera::Span<uint8_t>& data)
 {
+    if (this->drawChangedTiles(data, SSD1351WIDTH, SSD1351HEIGHT, BYTES_PER_PIXEL))
+        return;
+
     uint8_t *buffer = data.data();
     for (uint8_t y = 0; y < SSD1351HEIGHT; y += 8)
     {
@@ -78,6 +85,7 @@ void Ssd1351::drawImage(libcamera::Span<uint8_t>& data)
 
 void Ssd1351::drawPixel(int16_t x, int16_t y, uint32_t colour)
 {
+    this->invalidateFrame();
     if ((x >= 0) && (x < SSD1351WIDTH) && (y >= 0) && (y < SSD1351HEIGHT)) {
         uint8_t buffer[2] = {(uint8_t)(colour>>8), (uint8_t) (colour & 0x00FF)};
         this->setAddrWindow(x, y, 1, 1);
@@ -87,6 +95,7 @@ void Ssd1351::drawPixel(int16_t x, int16_t y, uint32_t colour)
 
 void Ssd1351::fillWithColour(uint32_t colour)
 {
+    this->invalidateFrame();
     uint32_t numPixels = SSD1351WIDTH * SSD1351HEIGHT;
     uint8_t buffer[3072];
     for (uint32_t i = 0; i < 3072; i+=3)
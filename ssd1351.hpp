@@ -54,11 +54,13 @@
 
 class Ssd1351 : public Display {
     public:
-        Ssd1351(const char *spi_dev, int cs, int dc, int rst = -1);
+        Ssd1351(std::unique_ptr<DisplayBus> bus);
         void drawImage(libcamera::Span<uint8_t>& data) override;
         void drawPixel(int16_t x, int16_t y, uint32_t color) override;
         void fillWithColour(uint32_t colour) override;
         void displayOff() override;
     protected:
         void setAddrWindow(uint16_t x1, uint16_t y1, uint16_t w, uint16_t h) override;
+    private:
+        void init();
 };